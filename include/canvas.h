@@ -18,6 +18,8 @@
 #include <stdint.h>
 
 namespace rgb_matrix {
+struct Color;
+
 // An interface for things a Canvas can do. The RGBMatrix implements this
 // interface, so you can use it directly wherever a canvas is needed.
 //
@@ -41,6 +43,12 @@ public:
   virtual void SetPixel(int x, int y,
                         uint8_t red, uint8_t green, uint8_t blue) = 0;
 
+  // Set a rectangle of "width" x "height" pixels at (x,y) from "colors",
+  // which contains width * height values in row-major order.
+  // The default implementation just calls SetPixel() for each of them, but
+  // implementations such as the FrameCanvas provide a much faster bulk path.
+  virtual void SetPixels(int x, int y, int width, int height, Color *colors);
+
   // Clear screen to be all black.
   virtual void Clear() = 0;
 
@@ -20,6 +20,7 @@
 #include <sys/types.h>
 
 #include <string>
+#include <vector>
 
 namespace rgb_matrix {
 class FrameCanvas;
@@ -92,7 +93,10 @@ private:
 class StreamWriter {
 public:
   // Does not take ownership of StreamIO
-  StreamWriter(StreamIO *io);
+  // With "partial_frames", frames only contain the parts that changed
+  // since the previous frame. Streams written that way can not be read by
+  // versions of StreamReader that don't know about partial frames.
+  StreamWriter(StreamIO *io, bool partial_frames = false);
 
   // Stream out given canvas at the given time. "hold_time_us" indicates
   // for how long this frame is to be shown in microseconds.
@@ -102,7 +106,9 @@ private:
   void WriteFileHeader(const FrameCanvas &frame, size_t len);
 
   StreamIO *const io_;
+  const bool partial_frames_;
   bool header_written_;
+  std::vector<uint64_t> row_versions_;  // Of previous frame.
 };
 
 class StreamReader {
@@ -125,9 +131,12 @@ private:
     STREAM_ERROR,
   };
   bool ReadFileHeader(const FrameCanvas &frame);
+  bool ReadPartialFrame();
 
   StreamIO *io_;
   size_t frame_buf_size_;
+  bool partial_frames_;
+  uint32_t double_rows_;
   State state_;
 
   char *header_frame_buffer_;
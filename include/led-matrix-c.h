@@ -158,6 +158,26 @@ struct RGBLedMatrixOptions {
    * processes when waiting and renders single core boards more responsive.
    */
   bool disable_busy_waiting;     /* Corresponding flag: --led-busy-waiting */
+
+  /* Number of threads that help converting a canvas with RGB back buffer.
+   * 0 = convert in the calling thread.
+   */
+  int conversion_threads;   /* Corresponding flag: --led-conversion-threads */
+
+  /* Keep the refresh rate above this by automatically reducing
+   * pwm_lsb_nanoseconds and pwm_bits. 0 = off.
+   */
+  int min_refresh_rate_hz;  /* Corresponding flag: --led-min-refresh */
+
+  /* Split long bitplane pulses and spread them over the refresh. Less
+   * flicker on cameras, but more data to clock in.
+   */
+  bool split_bitplanes;     /* Corresponding flag: --led-split-bitplanes */
+
+  /* Compile frames into a list of GPIO writes when they are swapped in.
+   * Cheaper refresh of content that changes rarely.
+   */
+  bool compile_output;      /* Corresponding flag: --led-compile-output */
 };
 
 /**
@@ -200,6 +220,14 @@ struct RGBLedRuntimeOptions {
   // to. Unless chosen otherwise, the default is "daemon" for user and group.
   const char *drop_priv_user;
   const char *drop_priv_group;
+
+  // Maximum clock the panels accept in kHz. If set, the fastest gpio_slowdown
+  // staying below it is measured on startup. 0 = off.
+  int max_panel_clock_khz;  // Flag: --led-max-panel-clock-khz
+
+  // Where the output goes: NULL or "gpio" (default), "null" or
+  // "raw:<filename>" to write each frame as raw RGB to a file or fifo.
+  const char *output_backend;  // Flag: --led-output-backend
 };
 
 /**
@@ -333,6 +361,29 @@ void led_canvas_clear(struct LedCanvas *canvas);
 /** Fill matrix with given color. */
 void led_canvas_fill(struct LedCanvas *canvas, uint8_t r, uint8_t g, uint8_t b);
 
+/**
+ * Enable (1) or disable (0) the RGB back buffer of the canvas. With back
+ * buffer, setting pixels only stores the color and the conversion happens
+ * once in led_canvas_commit() or led_matrix_swap_on_vsync().
+ */
+void led_canvas_set_rgb_back_buffer(struct LedCanvas *canvas, int enable);
+
+/** Convert pending back buffer changes. No-op without back buffer. */
+void led_canvas_commit(struct LedCanvas *canvas);
+
+/**
+ * Read pixel at (x, y) from the back buffer into r, g, b.
+ * Returns 0 if there is no back buffer or the position is outside.
+ */
+int led_canvas_get_pixel(const struct LedCanvas *canvas, int x, int y,
+                         uint8_t *r, uint8_t *g, uint8_t *b);
+
+/**
+ * Enable (1) or disable (0) compact storage of the canvas, which needs
+ * less memory, but is expanded while being displayed. Keeps the content.
+ */
+void led_canvas_set_compact_storage(struct LedCanvas *canvas, int enable);
+
 /*** API to provide double-buffering. ***/
 
 /**
@@ -341,6 +392,14 @@ void led_canvas_fill(struct LedCanvas *canvas, uint8_t r, uint8_t g, uint8_t b);
  */
 struct LedCanvas *led_matrix_create_offscreen_canvas(struct RGBLedMatrix *matrix);
 
+/**
+ * Give back a canvas created with led_matrix_create_offscreen_canvas() that
+ * is not needed anymore. Don't use it afterwards.
+ * Returns 0 if the canvas is currently shown or not owned by this matrix.
+ */
+int led_matrix_release_offscreen_canvas(struct RGBLedMatrix *matrix,
+                                        struct LedCanvas *canvas);
+
 /**
  * Swap the given canvas (created with create_offscreen_canvas) with the
  * currently active canvas on vsync (blocks until vsync is reached).
@@ -356,9 +415,112 @@ struct LedCanvas *led_matrix_create_offscreen_canvas(struct RGBLedMatrix *matrix
 struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
                                            struct LedCanvas *canvas);
 
+/**
+ * Triple buffering without waiting for vsync: hand over the finished
+ * canvas and get back a canvas free for drawing the next frame. If frames
+ * are published faster than refreshed, only the newest one is shown.
+ */
+struct LedCanvas *led_matrix_publish_canvas(struct RGBLedMatrix *matrix,
+                                            struct LedCanvas *canvas);
+
+/**
+ * Queue the canvas to be shown at present_at_us (CLOCK_MONOTONIC in
+ * microseconds, see led_matrix_monotonic_micros()). Blocks while the queue
+ * is full; returns a canvas free for drawing the next frame.
+ */
+struct LedCanvas *led_matrix_present_canvas(struct RGBLedMatrix *matrix,
+                                            struct LedCanvas *canvas,
+                                            uint64_t present_at_us);
+
+/** Current CLOCK_MONOTONIC time in microseconds. */
+uint64_t led_matrix_monotonic_micros(void);
+
+/**
+ * Statistics of the refresh thread. Same as RGBMatrix::RefreshStats in
+ * led-matrix.h, see there for details. Times are in microseconds.
+ */
+struct LedRefreshStats {
+  uint64_t refreshes;
+
+  /* Refresh durations, without the first two seconds. */
+  uint32_t min_refresh_usec;
+  uint32_t max_refresh_usec;
+  uint32_t mean_refresh_usec;
+  uint32_t p50_refresh_usec;
+  uint32_t p90_refresh_usec;
+  uint32_t p99_refresh_usec;
+
+  /* Frame changes and latency until a new frame is shown. */
+  uint64_t swaps;
+  uint32_t mean_swap_latency_usec;
+  uint32_t p99_swap_latency_usec;
+  uint32_t max_swap_latency_usec;
+
+  uint64_t missed_deadlines;  /* Refreshes longer than the refresh limit. */
+  uint64_t late_frames;       /* Presented frames shown too late. */
+  uint64_t dropped_frames;    /* Frames replaced before being shown. */
+
+  uint64_t bitplanes;           /* Bitplanes of all refreshes. */
+  uint64_t blank_bitplanes;     /* ... left out as all black. */
+  uint64_t skipped_clock_outs;  /* ... not clocked in as same as before. */
+};
+
+/**
+ * Fill "stats" with the current refresh statistics.
+ * Returns 0 if the refresh thread is not running.
+ */
+int led_matrix_get_refresh_stats(struct RGBLedMatrix *matrix,
+                                 struct LedRefreshStats *stats);
+
+/**
+ * Get the output configuration currently used by the refresh thread, which
+ * might be reduced by min_refresh_rate_hz.
+ */
+void led_matrix_get_refresh_config(struct RGBLedMatrix *matrix,
+                                   int *pwm_bits, int *pwm_dither_bits,
+                                   int *pwm_lsb_nanoseconds);
+
+/**
+ * Switch profiling of the bitplane output phases on (1) or off (0).
+ * See RGBMatrix::SetRefreshProfiling().
+ */
+void led_matrix_set_refresh_profiling(struct RGBLedMatrix *matrix, int enable);
+
+/**
+ * Write the recorded profile as CSV to "out".
+ * Returns the number of bitplanes written.
+ */
+int led_matrix_write_refresh_profile(struct RGBLedMatrix *matrix, FILE *out);
+
+/**
+ * Histograms of sleep overshoot in microseconds. Same as
+ * RGBMatrix::SleepJitter in led-matrix.h, see there for details.
+ */
+#define LED_SLEEP_JITTER_BUCKETS 64
+struct LedSleepJitter {
+  uint32_t sleeps[LED_SLEEP_JITTER_BUCKETS];
+  uint32_t pulse_waits[LED_SLEEP_JITTER_BUCKETS];
+};
+
+/**
+ * Switch counting of the sleep jitter on (1) or off (0).
+ */
+void led_matrix_set_sleep_jitter_tracking(struct RGBLedMatrix *matrix,
+                                          int enable);
+void led_matrix_get_sleep_jitter(struct RGBLedMatrix *matrix,
+                                 struct LedSleepJitter *jitter);
+
 uint8_t led_matrix_get_brightness(struct RGBLedMatrix *matrix);
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix, uint8_t brightness);
 
+/**
+ * Brightness of the whole display in percent (0..100), applied while
+ * refreshing, without setting pixels again. Fades linearly over fade_ms.
+ */
+void led_matrix_set_display_brightness(struct RGBLedMatrix *matrix,
+                                       uint8_t percent, int fade_ms);
+uint8_t led_matrix_get_display_brightness(struct RGBLedMatrix *matrix);
+
 // Utility function: set an image from the given buffer containting pixels.
 //
 // Draw image of size "image_width" and "image_height" from pixel at
@@ -50,6 +50,9 @@ struct RuntimeOptions;
 // to the transformers, like with UArrangementTransformer in demo-main.cc.
 class RGBMatrix : public Canvas {
 public:
+  // Upper limit for Options::conversion_threads.
+  static constexpr int kMaxConversionThreads = 3;
+
   // Options to initialize the RGBMatrix. Also see the main README.md for
   // detailed descriptions of the command line flags.
   struct Options {
@@ -159,6 +162,28 @@ public:
     // Sleep instead of busy wait to free CPU cycles but get slightly less
     // accurate frame timing.
     bool disable_busy_waiting;   // Flag: --led-busy-waiting
+
+    // Number of threads that help converting a FrameCanvas with RGB back
+    // buffer in Commit(). They run on the cores not used by the refresh
+    // thread. 0 = convert in the calling thread.
+    int conversion_threads;      // Flag: --led-conversion-threads
+
+    // Keep the refresh rate at or above this many Hz by automatically
+    // trading pwm_bits down to 8, then display brightness (shorter
+    // pwm_lsb_nanoseconds) and then more pwm_bits, if necessary. They are
+    // restored when there is room again. See GetRefreshConfig(). 0 = off.
+    int min_refresh_rate_hz;     // Flag: --led-min-refresh
+
+    // Split the long pulses of the high bitplanes and spread them over the
+    // refresh; the brightest bitplane is then shown 8 times per refresh.
+    // Less flicker on cameras, but more data to clock in.
+    bool split_bitplanes;        // Flag: --led-split-bitplanes
+
+    // Compile each frame handed to the refresh thread into a linear list of
+    // GPIO writes, which makes refreshing unchanged content cheaper. Costs
+    // time on each swap and memory per frame, so best for content that
+    // changes rarely.
+    bool compile_output;         // Flag: --led-compile-output
   };
 
   // Factory to create a matrix. Additional functionality includes dropping
@@ -201,6 +226,8 @@ public:
   virtual int height() const;
   virtual void SetPixel(int x, int y,
                         uint8_t red, uint8_t green, uint8_t blue);
+  virtual void SetPixels(int x, int y, int width, int height,
+                         Color *colors);
   virtual void Clear();
   virtual void Fill(uint8_t red, uint8_t green, uint8_t blue);
 
@@ -217,9 +244,16 @@ public:
   // The ownership of the created Canvases remains with the RGBMatrix, so you
   // don't have to worry about deleting them (but you also don't want to create
   // more than needed as this will fill up your memory as they are only deleted
-  // when the RGBMatrix is deleted).
+  // when the RGBMatrix is deleted, or given back with ReleaseFrameCanvas()).
   FrameCanvas *CreateFrameCanvas();
 
+  // Give back a FrameCanvas that is no longer needed. Its memory is re-used
+  // by the next CreateFrameCanvas(), or freed. The canvas must not be used
+  // afterwards.
+  // Returns false and does nothing if the canvas is currently shown or about
+  // to be shown by SwapOnVSync(), or was not created by this matrix.
+  bool ReleaseFrameCanvas(FrameCanvas *canvas);
+
   // This method waits to the next VSync and swaps the active buffer with the
   // supplied buffer. The formerly active buffer is returned.
   //
@@ -238,6 +272,113 @@ public:
   // time-correct animations.
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction = 1);
 
+  // Triple buffering alternative to SwapOnVSync() that does not wait.
+  // Hands over the finished canvas, which is shown from the next refresh on
+  // unless a newer one is published before ("latest frame wins"), and
+  // immediately returns a canvas that is free to draw the next frame into.
+  // The content of the returned canvas is undefined; it is either the
+  // formerly shown frame or a published frame that was never shown.
+  // The first call creates the third canvas.
+  //
+  // Returns NULL if the refresh thread is not running. Don't mix with
+  // SwapOnVSync().
+  FrameCanvas *PublishFrameCanvas(FrameCanvas *canvas);
+
+  // Queue a canvas to be shown from the first refresh that starts at or
+  // after "present_at_us", in microseconds of MonotonicMicros(). Meant for
+  // animations: decode ahead and give each frame its absolute presentation
+  // time instead of sleeping between SwapOnVSync() calls, so that timing
+  // errors don't accumulate. Canvases must be queued in order of their
+  // time; if several are due, only the last of them is shown.
+  //
+  // Blocks while the queue is full (8 frames). Returns a canvas to draw
+  // the next frame into: one that was replaced on the screen or, while the
+  // queue fills, a newly created one. Returns NULL if the refresh thread is
+  // not running. Don't mix with SwapOnVSync() or PublishFrameCanvas().
+  FrameCanvas *PresentFrameCanvas(FrameCanvas *canvas, uint64_t present_at_us);
+
+  // Current time for PresentFrameCanvas(): CLOCK_MONOTONIC in microseconds.
+  static uint64_t MonotonicMicros();
+
+  // Statistics of the refresh thread since it started. Times are in
+  // microseconds; percentiles are approximate (within about 6%).
+  struct RefreshStats {
+    uint64_t refreshes;          // Number of refreshes of the whole panel.
+
+    // Duration of each refresh, including waiting for
+    // limit_refresh_rate_hz. Refreshes of the first two seconds are not
+    // included here, as timing is irregular while starting up.
+    uint32_t min_refresh_usec;
+    uint32_t max_refresh_usec;
+    uint32_t mean_refresh_usec;
+    uint32_t p50_refresh_usec;
+    uint32_t p90_refresh_usec;
+    uint32_t p99_refresh_usec;
+
+    // Frame changes with SwapOnVSync(), PublishFrameCanvas() or
+    // PresentFrameCanvas(), and the latency from handing over a frame (or
+    // its presentation time) until it is shown.
+    uint64_t swaps;
+    uint32_t mean_swap_latency_usec;
+    uint32_t p99_swap_latency_usec;
+    uint32_t max_swap_latency_usec;
+
+    // Refreshes that took longer than limit_refresh_rate_hz allows.
+    uint64_t missed_deadlines;
+    // Frames of PresentFrameCanvas() shown more than a refresh too late.
+    uint64_t late_frames;
+    // Frames that were replaced by a newer frame before being shown.
+    uint64_t dropped_frames;
+
+    // Bitplanes of all refreshes. Of these, how many were left out as they
+    // were all black, and how many were not clocked in because they were
+    // the same as the bitplane before.
+    uint64_t bitplanes;
+    uint64_t blank_bitplanes;
+    uint64_t skipped_clock_outs;
+  };
+
+  // Fill "stats" with the current statistics. Cheap, and does not disturb
+  // the refresh. Returns false if the refresh thread is not running.
+  bool GetRefreshStats(RefreshStats *stats) const;
+
+  // Profile the output of each bitplane: how long clocking in the data,
+  // waiting for the previous output-enable pulse, setting the row address
+  // and strobing take. Meant to tune --led-pwm-lsb-nanoseconds and
+  // --led-slowdown-gpio from data. Takes two clock readings more per
+  // phase, and while on, the generic output path is used for all panel
+  // sizes.
+  void SetRefreshProfiling(bool enable);
+
+  // Write the most recent profiled bitplanes (up to 16384) as CSV, with
+  // columns frame,row,plane,clock_in_ns,oe_wait_ns,address_ns,strobe_ns.
+  // Returns the number of bitplanes written.
+  int WriteRefreshProfile(FILE *out) const;
+
+  // Output configuration the refresh thread currently uses. Different from
+  // the Options only if Options::min_refresh_rate_hz had to reduce it.
+  struct RefreshConfig {
+    int pwm_bits;
+    int pwm_dither_bits;
+    int pwm_lsb_nanoseconds;
+  };
+  void GetRefreshConfig(RefreshConfig *config) const;
+
+  // Histograms of how many microseconds the sleeps timing the output enable
+  // pulses overshot, beyond what busy-waiting after them can correct. Each
+  // overshoot makes a bitplane too bright, which shows as flicker; usually
+  // caused by kernel scheduling. Counts wrap around, so use differences.
+  struct SleepJitter {
+    static constexpr int kBuckets = 64;  // The last one for 63 and more.
+    uint32_t sleeps[kBuckets];       // Pulses timed by sleeping, and waits.
+    uint32_t pulse_waits[kBuckets];  // Waiting for hardware pulses.
+  };
+
+  // Counting is off by default and costs nothing while off. Covers all
+  // matrices of the process.
+  void SetSleepJitterTracking(bool enable);
+  void GetSleepJitter(SleepJitter *jitter) const;
+
   // -- Setting shape and behavior of matrix.
 
   // Apply a pixel mapper. This is used to re-map pixels according to some
@@ -266,10 +407,22 @@ public:
   bool luminance_correct() const;
 
   // Set brightness in percent for all created FrameCanvas. 1%..100%.
-  // This will only affect newly set pixels.
+  // Without a back buffer, this only affects newly set pixels. With
+  // FrameCanvas::SetRGBBackBuffer(true), the whole frame is converted again
+  // with the new brightness on its next Commit() or swap.
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  // Brightness of the whole display in percent, 0%..100%, applied while
+  // refreshing by shortening the time the LEDs are on. Unlike
+  // SetBrightness(), this does not need any pixels to be set again and
+  // keeps the full color depth of the content; use it for dimming and
+  // fading the display. With "fade_ms" > 0, the change is a linear ramp
+  // over that time, starting from the current display brightness.
+  // Very low values are limited by the shortest possible pulse.
+  void SetDisplayBrightness(uint8_t percent, int fade_ms = 0);
+  uint8_t display_brightness() const;  // The target of the last change.
+
   //-- GPIO interaction.
   // This library uses the GPIO pins to drive the matrix; this is a safe way
   // to request the 'remaining' bits to be used for user purposes.
@@ -302,6 +455,36 @@ public:
   // Returns the bitmap of all GPIO input pins.
   uint64_t AwaitInputChange(int timeout_ms);
 
+  // Input changes as a queue of events, so that none are lost between two
+  // reads, e.g. a short button press. The refresh thread samples the inputs
+  // after each refresh and, with limit_refresh_rate_hz, at least every
+  // millisecond while it waits.
+  struct InputEvent {
+    uint64_t timestamp_us;  // When the change was seen; MonotonicMicros().
+    uint64_t bits;          // All input bits after the change.
+    uint64_t changed;       // The bits that changed.
+    uint32_t dropped;       // Events lost before this one as queue was full.
+  };
+  static constexpr int kInputEventQueueSize = 64;
+
+  // Debounce the given input bits: after a change, further changes of that
+  // pin are ignored for "debounce_us" microseconds. The first change is
+  // reported right away. 0 switches debouncing off (default). Needs the
+  // refresh thread to be running (see StartRefresh()).
+  void SetInputDebounce(uint64_t bits, uint32_t debounce_us);
+
+  // Read up to "max_events" queued input events, oldest first. If there
+  // are none, waits like poll() up to timeout_ms for one: 0 doesn't wait,
+  // a negative number waits forever. Returns the number of events read.
+  // Read from one thread at a time.
+  int ReadInputEvents(InputEvent *events, int max_events, int timeout_ms);
+
+  // File descriptor that becomes readable when there are input events, to
+  // wait for them with poll() or epoll together with other descriptors.
+  // ReadInputEvents() resets it once all queued events are read. -1 before
+  // the refresh thread is started.
+  int InputEventFd() const;
+
   // Request user writable GPIO bits.
   // This allows to request a bitmap of GPIO-bits to be used by the user for
   // writing.
@@ -377,6 +560,47 @@ public:
   // Copy content from other FrameCanvas owned by the same RGBMatrix.
   void CopyFrom(const FrameCanvas &other);
 
+  //-- Optional RGB back buffer.
+
+  // If enabled, the FrameCanvas keeps a plain RGB copy of its pixels.
+  // SetPixel() and friends then only store the color, which is much
+  // cheaper if pixels are overwritten several times per frame. The
+  // conversion to the internal representation happens once in Commit(),
+  // which SwapOnVSync() calls for the canvas it is about to show.
+  //
+  // The back buffer starts out black. Enable it after all pixel mappers
+  // have been applied. Disabling it commits pending changes.
+  //
+  // Serialize() and CopyFrom() (from a canvas with back buffer) see the state
+  // as of the last Commit(). Deserialize() or CopyFrom() a canvas without
+  // back buffer do not update the back buffer of this canvas; its content
+  // replaces the copied one with the next Commit() after a change.
+  void SetRGBBackBuffer(bool enable);
+  bool has_rgb_back_buffer() const;
+
+  // Convert changes in the back buffer, or changed brightness,
+  // luminance correction or PWM bits, to the internal representation.
+  // No-op without back buffer.
+  void Commit();
+
+  // Read back a pixel from the back buffer. Returns 'false' if there is no
+  // back buffer or x, y is outside the canvas.
+  bool GetPixel(int x, int y,
+                uint8_t *red, uint8_t *green, uint8_t *blue) const;
+
+  //-- Optional compact storage.
+
+  // If enabled, the FrameCanvas only stores the color bits of each parallel
+  // chain and expands them to the GPIO output while it is displayed. This
+  // needs a quarter of the memory with one parallel chain, but less savings
+  // with more chains. Useful for keeping many pre-rendered canvases around.
+  //
+  // Switching keeps the content. Only switch while the canvas is not
+  // displayed. Serialize() of a compact canvas returns the compact data;
+  // Deserialize() accepts either format.
+  void SetCompactStorage(bool enable);
+  bool has_compact_storage() const;
+
   // -- Canvas interface.
   virtual int width() const;
   virtual int height() const;
@@ -389,6 +613,7 @@ public:
 
 private:
   friend class RGBMatrix;
+  friend class StreamWriter;
 
   FrameCanvas(internal::Framebuffer *frame) : frame_(frame){}
   virtual ~FrameCanvas();   // Any FrameCanvas is owned by RGBMatrix.
@@ -439,6 +664,17 @@ struct RuntimeOptions {
   // to. Unless chosen otherwise, the default is "daemon" for user and group.
   const char *drop_priv_user;
   const char *drop_priv_group;
+
+  // Maximum clock the panels accept in kHz, from their data sheet. If set,
+  // the fastest gpio_slowdown staying below it is measured on startup
+  // instead of using gpio_slowdown. The result is cached on disk per board.
+  int max_panel_clock_khz;  // 0 = off. Flag: --led-max-panel-clock-khz
+
+  // Where the output goes. NULL or "gpio" writes the GPIO registers. "null"
+  // discards it and "raw:<filename>" writes each refreshed frame as raw RGB
+  // to the file or fifo. Both don't need a Raspberry Pi or root, e.g. to
+  // profile or try the rendering on any Linux host.
+  const char *output_backend;  // Flag: --led-output-backend
 };
 
 // Convenience utility functions to read standard rgb-matrix flags and create
@@ -0,0 +1,58 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+#ifndef RPI_RGBMATRIX_BITPLANE_TRANSPOSE_INTERNAL_H
+#define RPI_RGBMATRIX_BITPLANE_TRANSPOSE_INTERNAL_H
+
+#include <stdint.h>
+
+#include "gpio-bits.h"
+
+namespace rgb_matrix {
+namespace internal {
+// Transpose "count" mapped color values (one uint16_t per channel and pixel,
+// the result of the brightness/luminance mapping) of neighboring columns
+// into the bitplane words of the framebuffer.
+//
+// "out" points to the word of the first column in bitplane 0; the words of
+// bitplane b are found "plane_stride" words further for each plane. Only
+// planes first_plane..end_plane-1 are written.
+//
+// For each pixel and plane, the bits in "keep_mask" are preserved and the
+// r_bit, g_bit or b_bit are set if the corresponding color value has
+// the plane bit set.
+//
+// Uses NEON or SSE2/AVX2 if the compiler has them enabled, otherwise falls
+// back to TransposeBitplanesScalar().
+void TransposeBitplanes(const uint16_t *red, const uint16_t *green,
+                        const uint16_t *blue, int count,
+                        gpio_bits_t r_bit, gpio_bits_t g_bit, gpio_bits_t b_bit,
+                        gpio_bits_t keep_mask,
+                        int first_plane, int end_plane,
+                        gpio_bits_t *out, int plane_stride);
+
+// Reference implementation, one pixel and bit at a time. Produces the same
+// output as TransposeBitplanes().
+void TransposeBitplanesScalar(const uint16_t *red, const uint16_t *green,
+                              const uint16_t *blue, int count,
+                              gpio_bits_t r_bit, gpio_bits_t g_bit,
+                              gpio_bits_t b_bit, gpio_bits_t keep_mask,
+                              int first_plane, int end_plane,
+                              gpio_bits_t *out, int plane_stride);
+
+// Name of the implementation TransposeBitplanes() uses, e.g. "neon".
+const char *TransposeBitplanesImplementation();
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_BITPLANE_TRANSPOSE_INTERNAL_H
@@ -0,0 +1,213 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "bitplane-transpose-internal.h"
+
+// The vector implementations work on 32 bit lanes, so they are only used
+// if gpio_bits_t is 32 bit wide. DISABLE_BITPLANE_TRANSPOSE_AVX2 and
+// DISABLE_BITPLANE_TRANSPOSE_SIMD select a narrower implementation; the
+// tests use them to compare every kernel the compiler can build.
+#if defined(ENABLE_WIDE_GPIO_COMPUTE_MODULE) || defined(DISABLE_BITPLANE_TRANSPOSE_SIMD)
+   // scalar only.
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define BITPLANE_TRANSPOSE_NEON 1
+#elif defined(__AVX2__) && !defined(DISABLE_BITPLANE_TRANSPOSE_AVX2)
+#  include <immintrin.h>
+#  define BITPLANE_TRANSPOSE_AVX2 1
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#  define BITPLANE_TRANSPOSE_SSE2 1
+#endif
+
+namespace rgb_matrix {
+namespace internal {
+void TransposeBitplanesScalar(const uint16_t *red, const uint16_t *green,
+                              const uint16_t *blue, int count,
+                              gpio_bits_t r_bit, gpio_bits_t g_bit,
+                              gpio_bits_t b_bit, gpio_bits_t keep_mask,
+                              int first_plane, int end_plane,
+                              gpio_bits_t *out, int plane_stride) {
+  gpio_bits_t *bits = out + first_plane * plane_stride;
+  for (int plane = first_plane; plane < end_plane; ++plane) {
+    const uint16_t mask = 1 << plane;
+    for (int i = 0; i < count; ++i) {
+      gpio_bits_t color_bits = 0;
+      if (red[i] & mask)   color_bits |= r_bit;
+      if (green[i] & mask) color_bits |= g_bit;
+      if (blue[i] & mask)  color_bits |= b_bit;
+      bits[i] = (bits[i] & keep_mask) | color_bits;
+    }
+    bits += plane_stride;
+  }
+}
+
+#if BITPLANE_TRANSPOSE_NEON
+static void TransposeBitplanesVector(const uint16_t *red, const uint16_t *green,
+                                     const uint16_t *blue, int count,
+                                     gpio_bits_t r_bit, gpio_bits_t g_bit,
+                                     gpio_bits_t b_bit, gpio_bits_t keep_mask,
+                                     int first_plane, int end_plane,
+                                     gpio_bits_t *out, int plane_stride) {
+  const uint32x4_t r_bits = vdupq_n_u32(r_bit);
+  const uint32x4_t g_bits = vdupq_n_u32(g_bit);
+  const uint32x4_t b_bits = vdupq_n_u32(b_bit);
+  const uint32x4_t keep = vdupq_n_u32(keep_mask);
+  int i = 0;
+  for (/**/; i + 4 <= count; i += 4) {
+    const uint32x4_t r = vmovl_u16(vld1_u16(red + i));
+    const uint32x4_t g = vmovl_u16(vld1_u16(green + i));
+    const uint32x4_t b = vmovl_u16(vld1_u16(blue + i));
+    gpio_bits_t *bits = out + first_plane * plane_stride + i;
+    for (int plane = first_plane; plane < end_plane; ++plane) {
+      const uint32x4_t mask = vdupq_n_u32(1 << plane);
+      // vtst gives all ones in lanes in which the plane bit is set.
+      uint32x4_t color = vandq_u32(vtstq_u32(r, mask), r_bits);
+      color = vorrq_u32(color, vandq_u32(vtstq_u32(g, mask), g_bits));
+      color = vorrq_u32(color, vandq_u32(vtstq_u32(b, mask), b_bits));
+      // Bits from keep come from the old value, all others from color.
+      vst1q_u32(bits, vbslq_u32(keep, vld1q_u32(bits), color));
+      bits += plane_stride;
+    }
+  }
+  if (i < count) {
+    TransposeBitplanesScalar(red + i, green + i, blue + i, count - i,
+                             r_bit, g_bit, b_bit, keep_mask,
+                             first_plane, end_plane, out + i, plane_stride);
+  }
+}
+#elif BITPLANE_TRANSPOSE_AVX2
+static void TransposeBitplanesVector(const uint16_t *red, const uint16_t *green,
+                                     const uint16_t *blue, int count,
+                                     gpio_bits_t r_bit, gpio_bits_t g_bit,
+                                     gpio_bits_t b_bit, gpio_bits_t keep_mask,
+                                     int first_plane, int end_plane,
+                                     gpio_bits_t *out, int plane_stride) {
+  const __m256i r_bits = _mm256_set1_epi32(r_bit);
+  const __m256i g_bits = _mm256_set1_epi32(g_bit);
+  const __m256i b_bits = _mm256_set1_epi32(b_bit);
+  const __m256i keep = _mm256_set1_epi32(keep_mask);
+  int i = 0;
+  for (/**/; i + 8 <= count; i += 8) {
+    const __m256i r = _mm256_cvtepu16_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(red + i)));
+    const __m256i g = _mm256_cvtepu16_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(green + i)));
+    const __m256i b = _mm256_cvtepu16_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(blue + i)));
+    gpio_bits_t *bits = out + first_plane * plane_stride + i;
+    for (int plane = first_plane; plane < end_plane; ++plane) {
+      const __m256i mask = _mm256_set1_epi32(1 << plane);
+      // Comparing (value & mask) with mask gives all ones in lanes in which
+      // the plane bit is set.
+      __m256i color = _mm256_and_si256(
+        _mm256_cmpeq_epi32(_mm256_and_si256(r, mask), mask), r_bits);
+      color = _mm256_or_si256(color, _mm256_and_si256(
+        _mm256_cmpeq_epi32(_mm256_and_si256(g, mask), mask), g_bits));
+      color = _mm256_or_si256(color, _mm256_and_si256(
+        _mm256_cmpeq_epi32(_mm256_and_si256(b, mask), mask), b_bits));
+      __m256i *const dest = reinterpret_cast<__m256i*>(bits);
+      const __m256i old = _mm256_loadu_si256(dest);
+      _mm256_storeu_si256(dest,
+                          _mm256_or_si256(_mm256_and_si256(old, keep), color));
+      bits += plane_stride;
+    }
+  }
+  if (i < count) {
+    TransposeBitplanesScalar(red + i, green + i, blue + i, count - i,
+                             r_bit, g_bit, b_bit, keep_mask,
+                             first_plane, end_plane, out + i, plane_stride);
+  }
+}
+#elif BITPLANE_TRANSPOSE_SSE2
+static void TransposeBitplanesVector(const uint16_t *red, const uint16_t *green,
+                                     const uint16_t *blue, int count,
+                                     gpio_bits_t r_bit, gpio_bits_t g_bit,
+                                     gpio_bits_t b_bit, gpio_bits_t keep_mask,
+                                     int first_plane, int end_plane,
+                                     gpio_bits_t *out, int plane_stride) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i r_bits = _mm_set1_epi32(r_bit);
+  const __m128i g_bits = _mm_set1_epi32(g_bit);
+  const __m128i b_bits = _mm_set1_epi32(b_bit);
+  const __m128i keep = _mm_set1_epi32(keep_mask);
+  int i = 0;
+  for (/**/; i + 4 <= count; i += 4) {
+    const __m128i r = _mm_unpacklo_epi16(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(red + i)), zero);
+    const __m128i g = _mm_unpacklo_epi16(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(green + i)), zero);
+    const __m128i b = _mm_unpacklo_epi16(
+      _mm_loadl_epi64(reinterpret_cast<const __m128i*>(blue + i)), zero);
+    gpio_bits_t *bits = out + first_plane * plane_stride + i;
+    for (int plane = first_plane; plane < end_plane; ++plane) {
+      const __m128i mask = _mm_set1_epi32(1 << plane);
+      // Comparing (value & mask) with mask gives all ones in lanes in which
+      // the plane bit is set.
+      __m128i color = _mm_and_si128(
+        _mm_cmpeq_epi32(_mm_and_si128(r, mask), mask), r_bits);
+      color = _mm_or_si128(color, _mm_and_si128(
+        _mm_cmpeq_epi32(_mm_and_si128(g, mask), mask), g_bits));
+      color = _mm_or_si128(color, _mm_and_si128(
+        _mm_cmpeq_epi32(_mm_and_si128(b, mask), mask), b_bits));
+      __m128i *const dest = reinterpret_cast<__m128i*>(bits);
+      const __m128i old = _mm_loadu_si128(dest);
+      _mm_storeu_si128(dest, _mm_or_si128(_mm_and_si128(old, keep), color));
+      bits += plane_stride;
+    }
+  }
+  if (i < count) {
+    TransposeBitplanesScalar(red + i, green + i, blue + i, count - i,
+                             r_bit, g_bit, b_bit, keep_mask,
+                             first_plane, end_plane, out + i, plane_stride);
+  }
+}
+#else
+static void TransposeBitplanesVector(const uint16_t *red, const uint16_t *green,
+                                     const uint16_t *blue, int count,
+                                     gpio_bits_t r_bit, gpio_bits_t g_bit,
+                                     gpio_bits_t b_bit, gpio_bits_t keep_mask,
+                                     int first_plane, int end_plane,
+                                     gpio_bits_t *out, int plane_stride) {
+  TransposeBitplanesScalar(red, green, blue, count, r_bit, g_bit, b_bit,
+                           keep_mask, first_plane, end_plane,
+                           out, plane_stride);
+}
+#endif
+
+void TransposeBitplanes(const uint16_t *red, const uint16_t *green,
+                        const uint16_t *blue, int count,
+                        gpio_bits_t r_bit, gpio_bits_t g_bit, gpio_bits_t b_bit,
+                        gpio_bits_t keep_mask,
+                        int first_plane, int end_plane,
+                        gpio_bits_t *out, int plane_stride) {
+  TransposeBitplanesVector(red, green, blue, count, r_bit, g_bit, b_bit,
+                           keep_mask, first_plane, end_plane,
+                           out, plane_stride);
+}
+
+const char *TransposeBitplanesImplementation() {
+#if BITPLANE_TRANSPOSE_NEON
+  return "neon";
+#elif BITPLANE_TRANSPOSE_AVX2
+  return "avx2";
+#elif BITPLANE_TRANSPOSE_SSE2
+  return "sse2";
+#else
+  return "scalar";
+#endif
+}
+}  // namespace internal
+}  // namespace rgb_matrix
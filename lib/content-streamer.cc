@@ -15,6 +15,7 @@
 #include <algorithm>
 
 #include "gpio-bits.h"
+#include "framebuffer-internal.h"
 
 namespace rgb_matrix {
 
@@ -32,19 +33,24 @@ struct FileHeader {
   uint32_t buf_size;
   uint32_t width;
   uint32_t height;
-  uint64_t future_use1;
+  uint32_t double_rows;  // Parts of the buffer partial frames consist of.
+  uint32_t future_use1;
   uint64_t is_wide_gpio : 1;
-  uint64_t flags_future_use : 63;
+  uint64_t has_partial_frames : 1;
+  uint64_t flags_future_use : 62;
 };
 STATIC_ASSERT(file_header_size_changed, sizeof(FileHeader) == 32);
 
 static const uint32_t kFrameMagicValue = 0x12345678;
+static const uint32_t kPartialFrameFlag = 1;
 struct FrameHeader {
   uint32_t magic;  // kFrameMagic
   uint32_t size;
   uint32_t hold_time_us;  // How long this frame lasts in usec.
-  uint32_t future_use1;
-  uint64_t future_use2;
+  uint32_t flags;
+  // With kPartialFrameFlag, the data only contains the double rows that
+  // have their bit set here; the others stay as in the previous frame.
+  uint64_t changed_rows;
   uint64_t future_use3;
 };
 STATIC_ASSERT(file_header_size_changed, sizeof(FrameHeader) == 32);
@@ -136,7 +142,8 @@ static bool FullAppend(StreamIO *io, const void *buf, const size_t count) {
   return remaining == 0;
 }
 
-StreamWriter::StreamWriter(StreamIO *io) : io_(io), header_written_(false) {}
+StreamWriter::StreamWriter(StreamIO *io, bool partial_frames)
+  : io_(io), partial_frames_(partial_frames), header_written_(false) {}
 bool StreamWriter::Stream(const FrameCanvas &frame, uint32_t hold_time_us) {
   const char *data;
   size_t len;
@@ -149,8 +156,35 @@ bool StreamWriter::Stream(const FrameCanvas &frame, uint32_t hold_time_us) {
   h.magic = kFrameMagicValue;
   h.size = len;
   h.hold_time_us = hold_time_us;
-  FullAppend(io_, &h, sizeof(h));
-  return FullAppend(io_, data, len) == (ssize_t)len;
+
+  // Partial frames need the previous frame and a row mask that fits.
+  std::vector<uint64_t> versions;
+  if (partial_frames_) frame.frame_->MarkRowVersionsSeen(&versions);
+  const bool partial = (partial_frames_ && versions.size() <= 64
+                        && versions.size() == row_versions_.size());
+  if (!partial) {
+    row_versions_.swap(versions);
+    FullAppend(io_, &h, sizeof(h));
+    return FullAppend(io_, data, len) == (ssize_t)len;
+  }
+
+  const size_t row_bytes = len / versions.size();
+  h.flags = kPartialFrameFlag;
+  h.size = 0;
+  for (size_t row = 0; row < versions.size(); ++row) {
+    if (versions[row] != row_versions_[row]) {
+      h.changed_rows |= uint64_t(1) << row;
+      h.size += row_bytes;
+    }
+  }
+  row_versions_.swap(versions);
+  bool success = FullAppend(io_, &h, sizeof(h));
+  for (size_t row = 0; row < row_versions_.size() && success; ++row) {
+    if (h.changed_rows & (uint64_t(1) << row)) {
+      success = FullAppend(io_, data + row * row_bytes, row_bytes);
+    }
+  }
+  return success;
 }
 
 void StreamWriter::WriteFileHeader(const FrameCanvas &frame, size_t len) {
@@ -160,12 +194,15 @@ void StreamWriter::WriteFileHeader(const FrameCanvas &frame, size_t len) {
   header.height = frame.height();
   header.buf_size = len;
   header.is_wide_gpio = (sizeof(gpio_bits_t) > 4);
+  header.has_partial_frames = partial_frames_;
+  header.double_rows = frame.frame_->double_rows();
   FullAppend(io_, &header, sizeof(header));
   header_written_ = true;
 }
 
 StreamReader::StreamReader(StreamIO *io)
-  : io_(io), state_(STREAM_AT_BEGIN), header_frame_buffer_(NULL) {
+  : io_(io), partial_frames_(false), double_rows_(0), state_(STREAM_AT_BEGIN),
+    header_frame_buffer_(NULL) {
   io_->Rewind();
 }
 StreamReader::~StreamReader() { delete [] header_frame_buffer_; }
@@ -179,10 +216,14 @@ bool StreamReader::GetNext(FrameCanvas *frame, uint32_t* hold_time_us) {
   if (state_ == STREAM_AT_BEGIN && !ReadFileHeader(*frame)) return false;
   if (state_ != STREAM_READING) return false;
 
-  // Read header and expected buffer size.
-  if (!FullRead(io_, header_frame_buffer_,
-                sizeof(FrameHeader) + frame_buf_size_)) {
-    return false;
+  if (partial_frames_) {
+    if (!ReadPartialFrame()) return false;
+  } else {
+    // Read header and expected buffer size.
+    if (!FullRead(io_, header_frame_buffer_,
+                  sizeof(FrameHeader) + frame_buf_size_)) {
+      return false;
+    }
   }
 
   const FrameHeader &h = *reinterpret_cast<FrameHeader*>(header_frame_buffer_);
@@ -198,7 +239,7 @@ bool StreamReader::GetNext(FrameCanvas *frame, uint32_t* hold_time_us) {
   // In the future, we might allow larger buffers (audio?), but never smaller.
   // For now, we need to make sure to exactly match the size, as our assumption
   // above is that we can read the full header + frame in one FullRead().
-  if (h.size != frame_buf_size_)
+  if (!partial_frames_ && h.size != frame_buf_size_)
     return false;
 
   if (hold_time_us) *hold_time_us = h.hold_time_us;
@@ -230,10 +271,47 @@ bool StreamReader::ReadFileHeader(const FrameCanvas &frame) {
     state_ = STREAM_ERROR;
     return false;
   }
+  if (header.has_partial_frames
+      && (header.double_rows == 0 || header.double_rows > 64
+          || header.buf_size % header.double_rows != 0)) {
+    state_ = STREAM_ERROR;
+    return false;
+  }
   state_ = STREAM_READING;
   frame_buf_size_ = header.buf_size;
+  partial_frames_ = header.has_partial_frames;
+  double_rows_ = header.double_rows;
   if (!header_frame_buffer_)
     header_frame_buffer_ = new char [ sizeof(FrameHeader) + header.buf_size ];
   return true;
 }
+
+// Read the next frame of a stream with partial frames. The data after the
+// header in header_frame_buffer_ keeps the previous frame, so we only need to
+// update the double rows that changed.
+bool StreamReader::ReadPartialFrame() {
+  FrameHeader *h = reinterpret_cast<FrameHeader*>(header_frame_buffer_);
+  if (!FullRead(io_, h, sizeof(FrameHeader)))
+    return false;
+  if (h->magic != kFrameMagicValue) {
+    return true;  // Reported by caller.
+  }
+  char *const data = header_frame_buffer_ + sizeof(FrameHeader);
+  if ((h->flags & kPartialFrameFlag) == 0) {
+    if (h->size != frame_buf_size_) return false;
+    return FullRead(io_, data, frame_buf_size_);
+  }
+  const size_t row_bytes = frame_buf_size_ / double_rows_;
+  if (h->size != row_bytes * __builtin_popcountll(h->changed_rows)
+      || (double_rows_ < 64 && (h->changed_rows >> double_rows_) != 0)) {
+    state_ = STREAM_ERROR;
+    return false;
+  }
+  for (uint32_t row = 0; row < double_rows_; ++row) {
+    if ((h->changed_rows & (uint64_t(1) << row)) == 0) continue;
+    if (!FullRead(io_, data + row * row_bytes, row_bytes))
+      return false;
+  }
+  return true;
+}
 }  // namespace rgb_matrix
@@ -18,14 +18,21 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <atomic>
+#include <vector>
+
 #include "hardware-mapping.h"
 #include "../include/graphics.h"
+#include "../include/thread.h"
 
 namespace rgb_matrix {
 class GPIO;
 class PinPulser;
+class PixelMapper;
 namespace internal {
+class RefreshProfiler;
 class RowAddressSetter;
+class WorkerPool;
 
 // An opaque type used within the framebuffer that can be used
 // to copy between PixelMappers.
@@ -38,6 +45,21 @@ struct PixelDesignator {
   gpio_bits_t mask;
 };
 
+// Pixels of a row that are next to each other in the bitplane buffer and
+// share the same color bits, so they can be converted in one go.
+struct PixelRun {
+  const PixelDesignator *designator;  // Of the first pixel.
+  int offset;  // Position of the first pixel in the map: y * width + x
+  int count;
+};
+
+// All runs of a PixelDesignatorMap, grouped by the double row they write to.
+// Runs of different double rows never touch the same bitplane words.
+struct PixelRunPlan {
+  std::vector<PixelRun> runs;
+  std::vector<int> double_row_start;  // Index into runs; double_rows + 1
+};
+
 class PixelDesignatorMap {
 public:
   PixelDesignatorMap(int width, int height, const PixelDesignator &fill_bits);
@@ -53,13 +75,25 @@ public:
   // All bits that set red/green/blue pixels; used for Fill().
   const PixelDesignator &GetFillColorBits() { return fill_bits_; }
 
+  // Get the runs covering the whole map. Created on first call, so
+  // the designators must not change afterwards.
+  const PixelRunPlan &GetRunPlan(int double_rows, int words_per_double_row);
+
 private:
   const int width_;
   const int height_;
   const PixelDesignator fill_bits_;  // Precalculated for fill.
   PixelDesignator *const buffer_;
+
+  Mutex run_plan_mutex_;
+  PixelRunPlan *run_plan_;
 };
 
+// Returns a new map with "mapper" applied on top of "map", which is left
+// as it is; NULL if the mapper doesn't accept the size of "map".
+PixelDesignatorMap *ApplyPixelMapper(const PixelMapper &mapper,
+                                     PixelDesignatorMap *map);
+
 // Internal representation of the frame-buffer that as well can
 // write itself to GPIO.
 // Our internal memory layout mimicks as much as possible what needs to be
@@ -84,6 +118,9 @@ public:
   static constexpr int kBitPlanes = 11;
   static constexpr int kDefaultBitPlanes = 11;
 
+  // Maximum number of neighboring pixels SetPixels() converts in one go.
+  static constexpr int kPixelRunLength = 16;
+
   Framebuffer(int rows, int columns, int parallel,
               int scan_mode,
               const char* led_sequence, bool inverse_color,
@@ -92,6 +129,10 @@ public:
 
   // Initialize GPIO bits for output. Only call once.
   static void InitHardwareMapping(const char *named_hardware);
+  // The mapping chosen in InitHardwareMapping().
+  static const struct HardwareMapping &hardware_mapping() {
+    return *hardware_mapping_;
+  }
   static void InitGPIO(GPIO *io, int rows, int parallel,
                        bool allow_hardware_pulsing,
                        int pwm_lsb_nanoseconds,
@@ -99,6 +140,17 @@ public:
                        int row_address_type);
   static void InitializePanels(GPIO *io, const char *panel_type, int columns);
 
+  // Scale the time each bitplane is shown to permille/1000. This dims the
+  // whole display without touching any pixel data. Needs InitGPIO().
+  static void SetOutputScale(int permille);
+
+  // Split the long pulses of the high bitplanes into kSplitPasses pulses
+  // and spread them over the refresh, so that even the brightest bitplane
+  // is shown several times per refresh. This moves flicker to higher
+  // frequencies (which cameras pick up less) at the cost of clocking in
+  // data more often. Needs InitGPIO().
+  static void SetSplitBitplanes(bool split);
+
   // Set PWM bits used for output. Default is 11, but if you only deal with
   // simple comic-colors, 1 might be sufficient. Lower require less CPU.
   // Returns boolean to signify if value was within range.
@@ -106,22 +158,67 @@ public:
   uint8_t pwmbits() { return pwm_bits_; }
 
   // Map brightness of output linearly to input with CIE1931 profile.
-  void set_luminance_correct(bool on) { do_luminance_correct_ = on; }
+  void set_luminance_correct(bool on) {
+    do_luminance_correct_ = on;
+    color_lookup_dirty_ = rgb_dirty_ = true;
+  }
   bool luminance_correct() const { return do_luminance_correct_; }
 
   // Set brightness in percent; range=1..100
-  // This will only affect newly set pixels.
+  // Without RGB back buffer, this only affects newly set pixels; with it,
+  // the whole frame is converted again on the next Commit().
   void SetBrightness(uint8_t b) {
     brightness_ = (b <= 100 ? (b != 0 ? b : 1) : 100);
+    color_lookup_dirty_ = rgb_dirty_ = true;
   }
   uint8_t brightness() { return brightness_; }
 
-  void DumpToMatrix(GPIO *io, int pwm_bits_to_show);
+  struct OutputCounts {
+    int bitplanes;           // Bitplanes output (split ones several times).
+    int blank_bitplanes;     // ... that were all black and not clocked in.
+    int skipped_clock_outs;  // ... that were only latched, see below.
+  };
+
+  // Output the frame. Bitplanes that are all black are not clocked in;
+  // their pulse time is waited out with the output off, so that the time
+  // per row does not depend on the content. Bitplanes that are the same as
+  // the bitplane before are not clocked in again, as the panel's shift
+  // registers still have them.
+  void DumpToMatrix(GPIO *io, int pwm_bits_to_show,
+                    OutputCounts *counts = NULL);
+
+  // Compile the output of the current content into a linear program of
+  // GPIO writes and pulses, which DumpToMatrix() replays as long as the
+  // content doesn't change. Called when a frame is handed to the refresh
+  // thread if Options::compile_output is set; safe while the frame is
+  // shown, but waits for a refresh replaying the previous program.
+  void CompileOutput();
 
   void Serialize(const char **data, size_t *len) const;
   bool Deserialize(const char *data, size_t len);
   void CopyFrom(const Framebuffer *other);
 
+  // Determine which bitplanes are lit in rows written pixel by pixel since
+  // the last call, so that rows which turned black are left out again in
+  // DumpToMatrix(). Call before showing the frame.
+  void RecomputeLitPlanes();
+
+  // The Serialize()d data consists of double_rows() parts of equal size.
+  int double_rows() const { return double_rows_; }
+
+  // When the frame was handed to the refresh thread, in
+  // GetMicrosecondCounter() time. Travels with the frame, so the refresh
+  // thread reads the time of exactly the frame it took over.
+  void set_publish_time_us(uint32_t t) { publish_time_us_ = t; }
+  uint32_t publish_time_us() const { return publish_time_us_; }
+
+  // Get the content version of each double row and mark them as seen.
+  // Double rows with the same version have the same content, in this or
+  // any other Framebuffer. Rows modified after this call get a new version,
+  // so this can be used to find the rows changed since. The content is not
+  // changed, so this works on const (e.g. streamed) framebuffers.
+  void MarkRowVersionsSeen(std::vector<uint64_t> *versions) const;
+
   // Canvas-inspired methods, but we're not implementing this interface to not
   // have an unnecessary vtable.
   int width() const;
@@ -131,9 +228,134 @@ public:
   void Clear();
   void Fill(uint8_t red, uint8_t green, uint8_t blue);
 
+  // Set pool used by Commit() to convert double rows in parallel.
+  // NULL to convert in the calling thread. Owned by the caller.
+  static void SetConversionPool(WorkerPool *pool);
+
+  // While a profiler is set, DumpToMatrix() records the time of each
+  // output phase in it. Does not take ownership; NULL to stop profiling.
+  static void SetRefreshProfiler(RefreshProfiler *profiler);
+
+  // Length of the run of pixels starting at "first" that can be converted
+  // together. "max_count" limits the number of pixels to look at.
+  static int PixelRunLength(const PixelDesignator *first, int max_count);
+
+  // With the RGB back buffer enabled, the pixel writing methods above only
+  // store the color; Commit() converts the whole buffer into bitplanes.
+  // The back buffer starts out black.
+  void SetRGBBackBuffer(bool enable);
+  bool has_rgb_back_buffer() const { return rgb_buffer_ != NULL; }
+  void Commit();
+  bool GetPixel(int x, int y,
+                uint8_t *red, uint8_t *green, uint8_t *blue) const;
+
+  // Compact storage only keeps the color bits of each chain: one byte per
+  // chain instead of a whole gpio word per column and bitplane. They are
+  // expanded to gpio words while clocking out. Switching converts the
+  // current content; only switch while not being displayed.
+  void SetCompactStorage(bool compact);
+  bool has_compact_storage() const { return compact_buffer_ != NULL; }
+
+  // Prepare for re-use as if newly created: drop back buffer, compact
+  // storage and compiled output without converting their content, then
+  // clear.
+  void Recycle();
+
 private:
+  class ConversionTask;
+
+  // Output of the whole frame. If there is a version of DumpFixedToMatrix()
+  // for our geometry, it is in fixed_dump_; it only handles the full
+  // bitplane buffer. Everything else goes through DumpGenericToMatrix().
+  typedef void (Framebuffer::*DumpFunction)(GPIO *io, int start_bit,
+                                            OutputCounts *counts);
+  static DumpFunction FixedDumpFunction(int columns, int double_rows,
+                                        int scan_mode);
+  template <int kColumns, int kDoubleRows, int kScanMode>
+  void DumpFixedToMatrix(GPIO *io, int start_bit, OutputCounts *counts);
+  void DumpGenericToMatrix(GPIO *io, int start_bit, OutputCounts *counts,
+                           RefreshProfiler *profiler);
+  void DumpSplitToMatrix(GPIO *io, int start_bit, OutputCounts *counts,
+                         RefreshProfiler *profiler);
+
+  // Result of CompileOutput(): for each bitplane output a step, with the
+  // words to clock in (columns_ of them from first_word on).
+  struct OutputProgram {
+    struct Step {
+      uint32_t first_word;
+      uint8_t row;
+      uint8_t plane;
+      uint8_t pulse;
+      bool same_as_previous;  // Data same as the step before.
+      bool blank;             // All black: only a dark pulse, no data.
+    };
+    struct Word {
+      gpio_bits_t clear;
+      gpio_bits_t set;
+    };
+    std::vector<Step> steps;
+    std::vector<Word> words;
+    int outputs[kBitPlanes];  // Outputs of each bitplane, including...
+    int blank[kBitPlanes];    // ... the blank ones, only a dark pulse.
+
+    gpio_bits_t color_clk_mask;
+
+    // Content it was compiled for.
+    uint32_t generation;
+    int pwm_bits;
+    bool split;
+  };
+  bool ProgramMatches(const OutputProgram &program, int start_bit) const;
+  void ReplayProgram(const OutputProgram &program, GPIO *io, int start_bit,
+                     OutputCounts *counts);
+  inline void ContentChanged() {
+    content_generation_.fetch_add(1, std::memory_order_relaxed);
+  }
+  // Held while DumpToMatrix() replays a program, so that CompileOutput()
+  // only replaces programs that are not in use.
+  static Mutex program_lock_;
+  void FreeOutputPrograms();
+  inline void ShowBlankPlane(int pulse);
+  inline void ShowPlane(GPIO *io, int d_row, int pulse,
+                        gpio_bits_t color_clk_mask, RefreshProfiler *profiler);
+  gpio_bits_t ColorClockMask() const;
+
+  // Buffers are aligned to cache lines.
+  static constexpr size_t kBufferAlignment = 64;
+  static void *AllocateBuffer(size_t bytes);
+
+  static constexpr int kMaxParallel = 6;
+  static constexpr int kGpioBits = 8 * sizeof(gpio_bits_t);
+
   static const struct HardwareMapping *hardware_mapping_;
   static RowAddressSetter *row_setter_;
+  static WorkerPool *conversion_pool_;
+  static std::atomic<RefreshProfiler*> profiler_;
+
+  // With split bitplanes, the refresh consists of kSplitPasses passes over
+  // all rows. Bitplanes above kSplitPlane are shown in several passes with
+  // the pulse length of kSplitPlane, the others once; each pass takes
+  // about the same time.
+  static constexpr int kSplitPasses = 8;
+  static constexpr int kSplitPlane = kBitPlanes - 4;  // 8 pulses for MSB.
+  struct SplitPulse {
+    uint8_t plane;  // Bitplane to show...
+    uint8_t pulse;  // ... with the pulse length of this bitplane.
+  };
+  typedef std::vector<std::vector<SplitPulse> > SplitSchedule;  // [pass]
+  static SplitSchedule BuildSplitSchedule(int start_bit);
+  static bool split_bitplanes_;
+  static SplitSchedule split_schedule_[kBitPlanes];  // For each start bit.
+
+  // Lookup tables for compact storage, created in InitHardwareMapping().
+  // In compact storage, the bits of each chain are in the order
+  // r1, g1, b1, r2, g2, b2. For each color gpio bit, compact_chain_ has the
+  // chain it belongs to (-1 for none) and compact_bit_ the bit in the byte.
+  // compact_expand_ maps the byte of a chain back to gpio bits.
+  static int8_t compact_chain_[kGpioBits];
+  static uint8_t compact_bit_[kGpioBits];
+  static gpio_bits_t compact_expand_[kMaxParallel][64];
+  static void InitCompactTables(const struct HardwareMapping &h);
 
   // This returns the gpio-bit for given color (one of 'R', 'G', 'B'). This is
   // returning the right value in case "led_sequence" is _not_ "RGB"
@@ -144,8 +366,18 @@ private:
 
   void InitDefaultDesignator(int x, int y, const char *led_sequence,
                              PixelDesignator *designator);
+  void WritePixels(int x, int y, int width, int height, const Color *colors);
+  void ConvertDoubleRows(const PixelRunPlan &plan, int first, int end);
+  void SetPixelRun(const PixelDesignator &d, const Color *colors, int count);
+  void SetCompactRun(const PixelDesignator &d, const Color *colors, int count);
   inline void  MapColors(uint8_t r, uint8_t g, uint8_t b,
                          uint16_t *red, uint16_t *green, uint16_t *blue);
+  // Recalculate mapped_color_ and plane_pattern_ if brightness, luminance
+  // correction or pwm bits changed since the last call.
+  inline void UpdateColorLookup() {
+    if (color_lookup_dirty_) RebuildColorLookup();
+  }
+  void RebuildColorLookup();
   const int rows_;     // Number of rows. 16 or 32.
   const int parallel_; // Parallel rows of chains. 1 or 2.
   const int height_;   // rows * parallel
@@ -158,8 +390,49 @@ private:
   bool do_luminance_correct_;
   uint8_t brightness_;
 
+  // Lookup tables for the current brightness, luminance correction and
+  // pwm bits, indexed by 8 bit channel value.
+  // mapped_color_ is the value that is written into the bitplanes. In
+  // plane_pattern_, the bit of each displayed plane p is at bit position
+  // 3*(p - first displayed plane), so that the patterns of the three
+  // channels can be interleaved with shifts and or-ed together.
+  bool color_lookup_dirty_;
+  uint16_t mapped_color_[256];
+  uint64_t plane_pattern_[256];
+
+  // Optional back buffer, row by row with rgb_width_ pixels per row.
+  Color *rgb_buffer_;
+  int rgb_width_;
+  int rgb_height_;
+  bool rgb_dirty_;    // Bitplanes need to be re-created on Commit().
+
   const int double_rows_;
   const size_t buffer_size_;
+  const size_t compact_size_;
+
+  // Content version of each double row, see MarkRowVersionsSeen().
+  // Version 0 is the all-zero content left by Clear().
+  static uint64_t NewRowVersion();
+  inline void MarkRowWritten(long gpio_word) {
+    row_version_[gpio_word / (columns_ * kBitPlanes)] = write_version_;
+    ContentChanged();
+  }
+  uint64_t *const row_version_;
+  // Version for written rows. Renewed by MarkRowVersionsSeen().
+  mutable uint64_t write_version_;
+
+  // For each double row, bit b is set if bitplane b might not be all
+  // black. Writing pixels only adds bits and marks the row with
+  // kLitPlanesStale, so that RecomputeLitPlanes() determines them anew.
+  // Not used with inverse colors, where black is not all zero.
+  static constexpr uint16_t kAllPlanes = (1 << kBitPlanes) - 1;
+  static constexpr uint16_t kLitPlanesStale = 1 << 15;
+  static_assert(kBitPlanes < 15, "kLitPlanesStale overlaps a bitplane");
+  inline void MarkPlanesLit(long gpio_word, uint16_t planes) {
+    lit_planes_[gpio_word / (columns_ * kBitPlanes)] |= planes | kLitPlanesStale;
+  }
+  void UpdateLitPlanes(int double_row);
+  uint16_t *const lit_planes_;
 
   // The frame-buffer is organized in bitplanes.
   // Highest level (slowest to cycle through) are double rows.
@@ -170,6 +443,30 @@ private:
   gpio_bits_t *bitplane_buffer_;
   inline gpio_bits_t *ValueAt(int double_row, int column, int bit);
 
+  // Alternatively, with compact storage, the same layout with parallel_
+  // bytes instead of each gpio word. Only one of the buffers is allocated.
+  uint8_t *compact_buffer_;
+
+  DumpFunction fixed_dump_;  // NULL if there is no precompiled geometry.
+
+  // Incremented on each change of the content; see CompileOutput().
+  std::atomic<uint32_t> content_generation_;
+  std::atomic<OutputProgram*> program_;  // NULL if not compiled.
+  OutputProgram *spare_program_;  // Memory to re-use for the next one.
+
+  uint32_t publish_time_us_;  // See set_publish_time_us().
+
+  inline uint8_t *CompactAt(int double_row, int column, int bit);
+  inline gpio_bits_t ExpandCompact(const uint8_t *chains) const {
+    gpio_bits_t result = 0;
+    for (int i = 0; i < parallel_; ++i) result |= compact_expand_[i][chains[i]];
+    return result;
+  }
+  void CompactWords(const gpio_bits_t *words, size_t count,
+                    uint8_t *chains) const;
+  void ExpandWords(const uint8_t *chains, size_t count,
+                   gpio_bits_t *words) const;
+
   PixelDesignatorMap **shared_mapper_;  // Storage in RGBMatrix.
 };
 }  // namespace internal
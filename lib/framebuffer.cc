@@ -21,6 +21,7 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -28,8 +29,13 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
 
+#include "bitplane-transpose-internal.h"
 #include "gpio.h"
+#include "pixel-mapper.h"
+#include "refresh-profiler-internal.h"
+#include "worker-pool-internal.h"
 #include "../include/graphics.h"
 
 namespace rgb_matrix {
@@ -53,11 +59,72 @@ PixelDesignator *PixelDesignatorMap::get(int x, int y) {
 PixelDesignatorMap::PixelDesignatorMap(int width, int height,
                                        const PixelDesignator &fill_bits)
   : width_(width), height_(height), fill_bits_(fill_bits),
-    buffer_(new PixelDesignator[width * height]) {
+    buffer_(new PixelDesignator[width * height]), run_plan_(NULL) {
 }
 
 PixelDesignatorMap::~PixelDesignatorMap() {
   delete [] buffer_;
+  delete run_plan_;
+}
+
+const PixelRunPlan &PixelDesignatorMap::GetRunPlan(int double_rows,
+                                                   int words_per_double_row) {
+  MutexLock l(&run_plan_mutex_);
+  if (run_plan_ != NULL) return *run_plan_;
+
+  std::vector<std::vector<PixelRun> > by_double_row(double_rows);
+  for (int y = 0; y < height_; ++y) {
+    const PixelDesignator *row = buffer_ + y * width_;
+    int x = 0;
+    while (x < width_) {
+      if (row[x].gpio_word < 0) {  // non-used pixel marker.
+        ++x;
+        continue;
+      }
+      PixelRun run;
+      run.designator = &row[x];
+      run.offset = y * width_ + x;
+      run.count = Framebuffer::PixelRunLength(&row[x], width_ - x);
+      by_double_row[row[x].gpio_word / words_per_double_row].push_back(run);
+      x += run.count;
+    }
+  }
+
+  run_plan_ = new PixelRunPlan();
+  for (int d = 0; d < double_rows; ++d) {
+    run_plan_->double_row_start.push_back(run_plan_->runs.size());
+    run_plan_->runs.insert(run_plan_->runs.end(),
+                           by_double_row[d].begin(), by_double_row[d].end());
+  }
+  run_plan_->double_row_start.push_back(run_plan_->runs.size());
+  return *run_plan_;
+}
+
+PixelDesignatorMap *ApplyPixelMapper(const PixelMapper &mapper,
+                                     PixelDesignatorMap *map) {
+  const int old_width = map->width();
+  const int old_height = map->height();
+  int new_width, new_height;
+  if (!mapper.GetSizeMapping(old_width, old_height, &new_width, &new_height)) {
+    return NULL;
+  }
+  PixelDesignatorMap *new_map = new PixelDesignatorMap(
+    new_width, new_height, map->GetFillColorBits());
+  for (int y = 0; y < new_height; ++y) {
+    for (int x = 0; x < new_width; ++x) {
+      int orig_x = -1, orig_y = -1;
+      mapper.MapVisibleToMatrix(old_width, old_height,
+                                x, y, &orig_x, &orig_y);
+      if (orig_x < 0 || orig_y < 0 ||
+          orig_x >= old_width || orig_y >= old_height) {
+        fprintf(stderr, "Error in PixelMapper: (%d, %d) -> (%d, %d) [range: "
+                "%dx%d]\n", x, y, orig_x, orig_y, old_width, old_height);
+        continue;
+      }
+      *new_map->get(x, y) = *map->get(orig_x, orig_y);
+    }
+  }
+  return new_map;
 }
 
 // Different panel types use different techniques to set the row address.
@@ -320,6 +387,14 @@ private:
 
 const struct HardwareMapping *Framebuffer::hardware_mapping_ = NULL;
 RowAddressSetter *Framebuffer::row_setter_ = NULL;
+int8_t Framebuffer::compact_chain_[Framebuffer::kGpioBits];
+uint8_t Framebuffer::compact_bit_[Framebuffer::kGpioBits];
+gpio_bits_t Framebuffer::compact_expand_[Framebuffer::kMaxParallel][64];
+WorkerPool *Framebuffer::conversion_pool_ = NULL;
+std::atomic<RefreshProfiler*> Framebuffer::profiler_(NULL);
+bool Framebuffer::split_bitplanes_ = false;
+Framebuffer::SplitSchedule Framebuffer::split_schedule_[Framebuffer::kBitPlanes];
+Mutex Framebuffer::program_lock_;
 
 Framebuffer::Framebuffer(int rows, int columns, int parallel,
                          int scan_mode,
@@ -332,9 +407,17 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
     scan_mode_(scan_mode),
     inverse_color_(inverse_color),
     pwm_bits_(kBitPlanes), do_luminance_correct_(true), brightness_(100),
+    color_lookup_dirty_(true),
+    rgb_buffer_(NULL), rgb_width_(0), rgb_height_(0), rgb_dirty_(false),
     double_rows_(rows / SUB_PANELS_),
     buffer_size_(double_rows_ * columns_ * kBitPlanes * sizeof(gpio_bits_t)),
-    shared_mapper_(mapper) {
+    compact_size_(double_rows_ * columns_ * kBitPlanes * parallel),
+    row_version_(new uint64_t[double_rows_]),
+    write_version_(NewRowVersion()),
+    lit_planes_(new uint16_t[double_rows_]),
+    bitplane_buffer_(NULL), compact_buffer_(NULL),
+    content_generation_(0), program_(NULL), spare_program_(NULL),
+    publish_time_us_(0), shared_mapper_(mapper) {
   assert(hardware_mapping_ != NULL);   // Called InitHardwareMapping() ?
   assert(shared_mapper_ != NULL);  // Storage should be provided by RGBMatrix.
   assert(rows_ >=4 && rows_ <= 64 && rows_ % 2 == 0);
@@ -347,7 +430,11 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
   }
   assert(parallel >= 1 && parallel <= 6);
 
-  bitplane_buffer_ = new gpio_bits_t[double_rows_ * columns_ * kBitPlanes];
+  fixed_dump_ = FixedDumpFunction(columns_, double_rows_, scan_mode_);
+  bitplane_buffer_ = (gpio_bits_t*) AllocateBuffer(buffer_size_);
+  // Uninitialized content; make sure Clear() below will clear all rows.
+  std::fill(row_version_, row_version_ + double_rows_, write_version_);
+  std::fill(lit_planes_, lit_planes_ + double_rows_, (uint16_t)kAllPlanes);
 
   // If we're the first Framebuffer created, the shared PixelMapper is
   // still NULL, so create one.
@@ -381,7 +468,38 @@ Framebuffer::Framebuffer(int rows, int columns, int parallel,
 }
 
 Framebuffer::~Framebuffer() {
-  delete [] bitplane_buffer_;
+  free(bitplane_buffer_);
+  free(compact_buffer_);
+  delete [] row_version_;
+  delete [] lit_planes_;
+  delete [] rgb_buffer_;
+  delete program_.load();
+  delete spare_program_;
+}
+
+/* static */ void *Framebuffer::AllocateBuffer(size_t bytes) {
+  void *result = NULL;
+  if (posix_memalign(&result, kBufferAlignment, bytes) != 0) {
+    fprintf(stderr, "Can't allocate %zu bytes for framebuffer.\n", bytes);
+    abort();
+  }
+  return result;
+}
+
+void Framebuffer::Recycle() {
+  delete [] rgb_buffer_;
+  rgb_buffer_ = NULL;
+  rgb_dirty_ = false;
+  if (compact_buffer_) {
+    free(compact_buffer_);
+    compact_buffer_ = NULL;
+    bitplane_buffer_ = (gpio_bits_t*) AllocateBuffer(buffer_size_);
+  }
+  FreeOutputPrograms();
+  // Content is undefined now; make sure Clear() clears all rows.
+  write_version_ = NewRowVersion();
+  std::fill(row_version_, row_version_ + double_rows_, write_version_);
+  Clear();
 }
 
 // TODO: this should also be parsed from some special formatted string, e.g.
@@ -427,6 +545,37 @@ Framebuffer::~Framebuffer() {
       ++mapping->max_parallel_chains;
   }
   hardware_mapping_ = mapping;
+  InitCompactTables(*mapping);
+}
+
+/* static */ void Framebuffer::InitCompactTables(const HardwareMapping &h) {
+  const gpio_bits_t chain_bits[kMaxParallel][6] = {
+    { h.p0_r1, h.p0_g1, h.p0_b1, h.p0_r2, h.p0_g2, h.p0_b2 },
+    { h.p1_r1, h.p1_g1, h.p1_b1, h.p1_r2, h.p1_g2, h.p1_b2 },
+    { h.p2_r1, h.p2_g1, h.p2_b1, h.p2_r2, h.p2_g2, h.p2_b2 },
+    { h.p3_r1, h.p3_g1, h.p3_b1, h.p3_r2, h.p3_g2, h.p3_b2 },
+    { h.p4_r1, h.p4_g1, h.p4_b1, h.p4_r2, h.p4_g2, h.p4_b2 },
+    { h.p5_r1, h.p5_g1, h.p5_b1, h.p5_r2, h.p5_g2, h.p5_b2 },
+  };
+  for (int bit = 0; bit < kGpioBits; ++bit) {
+    compact_chain_[bit] = -1;
+    compact_bit_[bit] = 0;
+  }
+  for (int chain = 0; chain < kMaxParallel; ++chain) {
+    for (int i = 0; i < 6; ++i) {
+      if (chain_bits[chain][i] == 0) continue;
+      const int bit = __builtin_ctzll(chain_bits[chain][i]);
+      compact_chain_[bit] = chain;
+      compact_bit_[bit] = 1 << i;
+    }
+    for (int value = 0; value < 64; ++value) {
+      gpio_bits_t expanded = 0;
+      for (int i = 0; i < 6; ++i) {
+        if (value & (1 << i)) expanded |= chain_bits[chain][i];
+      }
+      compact_expand_[chain][value] = expanded;
+    }
+  }
 }
 
 /* static */ void Framebuffer::InitGPIO(GPIO *io, int rows, int parallel,
@@ -507,6 +656,68 @@ Framebuffer::~Framebuffer() {
                                           bitplane_timings);
 }
 
+/* static */ void Framebuffer::SetOutputScale(int permille) {
+  if (sOutputEnablePulser) sOutputEnablePulser->SetPulseScale(permille);
+}
+
+/* static */ void Framebuffer::SetSplitBitplanes(bool split) {
+  if (split && split_schedule_[0].empty()) {
+    for (int b = 0; b < kBitPlanes; ++b) {
+      split_schedule_[b] = BuildSplitSchedule(b);
+    }
+  }
+  split_bitplanes_ = split;
+}
+
+// Pulses of bitplane b are twice as long as these of b - 1 (see InitGPIO()),
+// at least above the dither bits, so a bitplane above kSplitPlane can be
+// shown as 2^(b - kSplitPlane) pulses of kSplitPlane.
+/* static */ Framebuffer::SplitSchedule
+Framebuffer::BuildSplitSchedule(int start_bit) {
+  SplitSchedule passes(kSplitPasses);
+  int load[kSplitPasses] = {0};  // In units of the shortest pulse.
+
+  // Pulses of one split bitplane go in evenly spaced passes.
+  for (int b = kBitPlanes - 1; b > kSplitPlane && b >= start_bit; --b) {
+    const int count = 1 << (b - kSplitPlane);
+    const int stride = kSplitPasses / count;
+    int best_offset = 0;
+    int best_load = INT_MAX;
+    for (int offset = 0; offset < stride; ++offset) {
+      int offset_load = 0;
+      for (int p = offset; p < kSplitPasses; p += stride) offset_load += load[p];
+      if (offset_load < best_load) {
+        best_load = offset_load;
+        best_offset = offset;
+      }
+    }
+    for (int p = best_offset; p < kSplitPasses; p += stride) {
+      const SplitPulse pulse = { (uint8_t)b, (uint8_t)kSplitPlane };
+      passes[p].push_back(pulse);
+      load[p] += 1 << kSplitPlane;
+    }
+  }
+
+  // The others go where there is the least to show.
+  for (int b = kSplitPlane; b >= start_bit; --b) {
+    const int p = std::min_element(load, load + kSplitPasses) - load;
+    const SplitPulse pulse = { (uint8_t)b, (uint8_t)b };
+    passes[p].push_back(pulse);
+    load[p] += 1 << b;
+  }
+
+  // Longest pulse last: clocking in the next row's data overlaps with it.
+  struct ShorterPulse {
+    bool operator()(const SplitPulse &a, const SplitPulse &b) const {
+      return a.pulse < b.pulse || (a.pulse == b.pulse && a.plane < b.plane);
+    }
+  };
+  for (int p = 0; p < kSplitPasses; ++p) {
+    std::sort(passes[p].begin(), passes[p].end(), ShorterPulse());
+  }
+  return passes;
+}
+
 // NOTE: first version for panel initialization sequence, need to refine
 // until it is more clear how different panel types are initialized to be
 // able to abstract this more.
@@ -612,6 +823,7 @@ bool Framebuffer::SetPWMBits(uint8_t value) {
   if (value < 1 || value > kBitPlanes)
     return false;
   pwm_bits_ = value;
+  color_lookup_dirty_ = rgb_dirty_ = true;
   return true;
 }
 
@@ -621,16 +833,108 @@ inline gpio_bits_t *Framebuffer::ValueAt(int double_row, int column, int bit) {
                             + column ];
 }
 
+inline uint8_t *Framebuffer::CompactAt(int double_row, int column, int bit) {
+  return &compact_buffer_[ (double_row * (columns_ * kBitPlanes)
+                            + bit * columns_
+                            + column) * parallel_ ];
+}
+
+void Framebuffer::CompactWords(const gpio_bits_t *words, size_t count,
+                               uint8_t *chains) const {
+  memset(chains, 0, count * parallel_);
+  for (size_t i = 0; i < count; ++i, chains += parallel_) {
+    for (gpio_bits_t w = words[i]; w != 0; w &= w - 1) {
+      const int bit = __builtin_ctzll(w);
+      const int chain = compact_chain_[bit];
+      if (chain >= 0 && chain < parallel_) chains[chain] |= compact_bit_[bit];
+    }
+  }
+}
+
+void Framebuffer::ExpandWords(const uint8_t *chains, size_t count,
+                              gpio_bits_t *words) const {
+  for (size_t i = 0; i < count; ++i, chains += parallel_) {
+    words[i] = ExpandCompact(chains);
+  }
+}
+
+void Framebuffer::SetCompactStorage(bool compact) {
+  if (compact == (compact_buffer_ != NULL)) return;
+  const size_t words = double_rows_ * columns_ * kBitPlanes;
+  if (compact) {
+    compact_buffer_ = (uint8_t*) AllocateBuffer(compact_size_);
+    CompactWords(bitplane_buffer_, words, compact_buffer_);
+    free(bitplane_buffer_);
+    bitplane_buffer_ = NULL;
+  } else {
+    bitplane_buffer_ = (gpio_bits_t*) AllocateBuffer(buffer_size_);
+    ExpandWords(compact_buffer_, words, bitplane_buffer_);
+    free(compact_buffer_);
+    compact_buffer_ = NULL;
+  }
+}
+
 void Framebuffer::Clear() {
+  if (rgb_buffer_) {
+    std::fill(rgb_buffer_, rgb_buffer_ + rgb_width_ * rgb_height_, Color());
+    rgb_dirty_ = true;
+    return;
+  }
   if (inverse_color_) {
     Fill(0, 0, 0);
   } else  {
-    // Cheaper.
-    memset(bitplane_buffer_, 0,
-           sizeof(*bitplane_buffer_) * double_rows_ * columns_ * kBitPlanes);
+    // Cheaper. Only rows that are not already cleared.
+    const int row_words = columns_ * kBitPlanes;
+    for (int row = 0; row < double_rows_; ++row) {
+      if (row_version_[row] == 0) continue;
+      if (compact_buffer_) {
+        memset(compact_buffer_ + row * row_words * parallel_, 0,
+               row_words * parallel_);
+      } else {
+        memset(bitplane_buffer_ + row * row_words, 0,
+               sizeof(*bitplane_buffer_) * row_words);
+      }
+      row_version_[row] = 0;
+      lit_planes_[row] = 0;
+    }
+    ContentChanged();
   }
 }
 
+/* static */ uint64_t Framebuffer::NewRowVersion() {
+  static std::atomic<uint64_t> last_version(0);  // 0 is reserved for Clear()
+  return ++last_version;
+}
+
+void Framebuffer::UpdateLitPlanes(int double_row) {
+  uint16_t lit = 0;
+  for (int b = 0; b < kBitPlanes; ++b) {
+    if (compact_buffer_) {
+      const uint8_t *chains = CompactAt(double_row, 0, b);
+      for (int i = 0; i < columns_ * parallel_; ++i) {
+        if (chains[i]) { lit |= 1 << b; break; }
+      }
+    } else {
+      const gpio_bits_t *row_data = ValueAt(double_row, 0, b);
+      for (int col = 0; col < columns_; ++col) {
+        if (row_data[col]) { lit |= 1 << b; break; }
+      }
+    }
+  }
+  lit_planes_[double_row] = lit;
+}
+
+void Framebuffer::RecomputeLitPlanes() {
+  for (int row = 0; row < double_rows_; ++row) {
+    if (lit_planes_[row] & kLitPlanesStale) UpdateLitPlanes(row);
+  }
+}
+
+void Framebuffer::MarkRowVersionsSeen(std::vector<uint64_t> *versions) const {
+  versions->assign(row_version_, row_version_ + double_rows_);
+  write_version_ = NewRowVersion();
+}
+
 // Do CIE1931 luminance correction and scale to output bitplanes
 static uint16_t luminance_cie1931(uint8_t c, uint8_t brightness) {
   float out_factor = ((1 << internal::Framebuffer::kBitPlanes) - 1);
@@ -665,38 +969,66 @@ static inline uint16_t DirectMapColor(uint8_t brightness, uint8_t c) {
   return (shift > 0) ? (c << shift) : (c >> -shift);
 }
 
+void Framebuffer::RebuildColorLookup() {
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  for (int c = 0; c < 256; ++c) {
+    uint16_t mapped = do_luminance_correct_
+      ? CIEMapColor(brightness_, c)
+      : DirectMapColor(brightness_, c);
+    if (inverse_color_) mapped = ~mapped;
+    mapped_color_[c] = mapped;
+
+    uint64_t pattern = 0;
+    for (int bit = min_bit_plane; bit < kBitPlanes; ++bit) {
+      if (mapped & (1 << bit))
+        pattern |= uint64_t(1) << (3 * (bit - min_bit_plane));
+    }
+    plane_pattern_[c] = pattern;
+  }
+  color_lookup_dirty_ = false;
+}
+
 inline void Framebuffer::MapColors(
   uint8_t r, uint8_t g, uint8_t b,
   uint16_t *red, uint16_t *green, uint16_t *blue) {
-
-  if (do_luminance_correct_) {
-    *red   = CIEMapColor(brightness_, r);
-    *green = CIEMapColor(brightness_, g);
-    *blue  = CIEMapColor(brightness_, b);
-  } else {
-    *red   = DirectMapColor(brightness_, r);
-    *green = DirectMapColor(brightness_, g);
-    *blue  = DirectMapColor(brightness_, b);
-  }
-
-  if (inverse_color_) {
-    *red = ~(*red);
-    *green = ~(*green);
-    *blue = ~(*blue);
-  }
+  UpdateColorLookup();
+  *red   = mapped_color_[r];
+  *green = mapped_color_[g];
+  *blue  = mapped_color_[b];
 }
 
 void Framebuffer::Fill(uint8_t r, uint8_t g, uint8_t b) {
+  if (rgb_buffer_) {
+    std::fill(rgb_buffer_, rgb_buffer_ + rgb_width_ * rgb_height_,
+              Color(r, g, b));
+    rgb_dirty_ = true;
+    return;
+  }
   uint16_t red, green, blue;
   MapColors(r, g, b, &red, &green, &blue);
   const PixelDesignator &fill = (*shared_mapper_)->GetFillColorBits();
 
-  for (int bits = kBitPlanes - pwm_bits_; bits < kBitPlanes; ++bits) {
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  uint16_t lit = 0;
+  for (int bits = min_bit_plane; bits < kBitPlanes; ++bits) {
     uint16_t mask = 1 << bits;
     gpio_bits_t plane_bits = 0;
     plane_bits |= ((red & mask) == mask)   ? fill.r_bit : 0;
     plane_bits |= ((green & mask) == mask) ? fill.g_bit : 0;
     plane_bits |= ((blue & mask) == mask)  ? fill.b_bit : 0;
+    if (plane_bits) lit |= mask;
+
+    if (compact_buffer_) {
+      uint8_t chains[kMaxParallel];
+      CompactWords(&plane_bits, 1, chains);
+      for (int row = 0; row < double_rows_; ++row) {
+        uint8_t *row_data = CompactAt(row, 0, bits);
+        for (int col = 0; col < columns_; ++col, row_data += parallel_) {
+          memcpy(row_data, chains, parallel_);
+        }
+      }
+      continue;
+    }
 
     for (int row = 0; row < double_rows_; ++row) {
       gpio_bits_t *row_data = ValueAt(row, 0, bits);
@@ -705,45 +1037,190 @@ void Framebuffer::Fill(uint8_t r, uint8_t g, uint8_t b) {
       }
     }
   }
+  std::fill(row_version_, row_version_ + double_rows_, write_version_);
+  // Planes below the displayed ones are left as they are.
+  const uint16_t kept = ((1 << min_bit_plane) - 1) | kLitPlanesStale;
+  for (int row = 0; row < double_rows_; ++row) {
+    lit_planes_[row] = (lit_planes_[row] & kept) | lit;
+  }
+  ContentChanged();
 }
 
 int Framebuffer::width() const { return (*shared_mapper_)->width(); }
 int Framebuffer::height() const { return (*shared_mapper_)->height(); }
 
 void Framebuffer::SetPixel(int x, int y, uint8_t r, uint8_t g, uint8_t b) {
+  if (rgb_buffer_) {
+    if (x < 0 || x >= rgb_width_ || y < 0 || y >= rgb_height_) return;
+    Color *const c = rgb_buffer_ + y * rgb_width_ + x;
+    c->r = r; c->g = g; c->b = b;
+    rgb_dirty_ = true;
+    return;
+  }
   const PixelDesignator *designator = (*shared_mapper_)->get(x, y);
   if (designator == NULL) return;
   const long pos = designator->gpio_word;
   if (pos < 0) return;  // non-used pixel marker.
 
-  uint16_t red, green, blue;
-  MapColors(r, g, b, &red, &green, &blue);
+  if (compact_buffer_) {
+    const Color color(r, g, b);
+    SetCompactRun(*designator, &color, 1);
+    return;
+  }
 
+  UpdateColorLookup();
+  // Bits 0..2 of the pattern are r, g, b of the lowest displayed plane,
+  // the next three bits are the following plane and so on.
+  uint64_t pattern = plane_pattern_[r]
+    | (plane_pattern_[g] << 1) | (plane_pattern_[b] << 2);
+
+  // The gpio bits for each combination of r, g, b in a plane.
+  gpio_bits_t color_bits[8];
+  color_bits[0] = 0;
+  color_bits[1] = designator->r_bit;
+  color_bits[2] = designator->g_bit;
+  color_bits[3] = designator->r_bit | designator->g_bit;
+  color_bits[4] = designator->b_bit;
+  color_bits[5] = designator->r_bit | designator->b_bit;
+  color_bits[6] = designator->g_bit | designator->b_bit;
+  color_bits[7] = designator->r_bit | designator->g_bit | designator->b_bit;
+
+  MarkRowWritten(pos);
+  MarkPlanesLit(pos, mapped_color_[r] | mapped_color_[g] | mapped_color_[b]);
   gpio_bits_t *bits = bitplane_buffer_ + pos;
   const int min_bit_plane = kBitPlanes - pwm_bits_;
   bits += (columns_ * min_bit_plane);
-  const gpio_bits_t r_bits = designator->r_bit;
-  const gpio_bits_t g_bits = designator->g_bit;
-  const gpio_bits_t b_bits = designator->b_bit;
   const gpio_bits_t designator_mask = designator->mask;
-  for (uint16_t mask = 1<<min_bit_plane; mask != 1<<kBitPlanes; mask <<=1 ) {
-    gpio_bits_t color_bits = 0;
-    if (red & mask)   color_bits |= r_bits;
-    if (green & mask) color_bits |= g_bits;
-    if (blue & mask)  color_bits |= b_bits;
-    *bits = (*bits & designator_mask) | color_bits;
+  for (int plane = min_bit_plane; plane < kBitPlanes; ++plane) {
+    *bits = (*bits & designator_mask) | color_bits[pattern & 0x7];
+    pattern >>= 3;
     bits += columns_;
   }
 }
 
 void Framebuffer::SetPixels(int x, int y, int width, int height, Color *colors) {
-  for (int iy = 0; iy < height; ++iy) {
-    for (int ix = 0; ix < width; ++ix) {
-      SetPixel(x + ix, y + iy, colors->r, colors->g, colors->b);
-      ++colors;
+  if (rgb_buffer_) {
+    const int x_start = std::max(0, -x);
+    const int x_end = std::min(width, rgb_width_ - x);
+    if (x_start >= x_end) return;
+    for (int iy = std::max(0, -y); iy < height && y + iy < rgb_height_; ++iy) {
+      memcpy(rgb_buffer_ + (y + iy) * rgb_width_ + x + x_start,
+             colors + iy * width + x_start,
+             (x_end - x_start) * sizeof(Color));
+    }
+    rgb_dirty_ = true;
+    return;
+  }
+  WritePixels(x, y, width, height, colors);
+}
+
+void Framebuffer::WritePixels(int x, int y, int width, int height,
+                              const Color *colors) {
+  PixelDesignatorMap *const map = *shared_mapper_;
+  // Clip to the visible area; pixels outside are ignored as in SetPixel().
+  const int x_start = std::max(0, -x);
+  const int x_end = std::min(width, map->width() - x);
+  if (x_start >= x_end) return;
+  for (int iy = 0; iy < height; ++iy, colors += width) {
+    if (y + iy < 0 || y + iy >= map->height()) continue;
+    // Designators of one row are consecutive in the map.
+    const PixelDesignator *row = map->get(x + x_start, y + iy);
+    int ix = x_start;
+    while (ix < x_end) {
+      const PixelDesignator *first = &row[ix - x_start];
+      if (first->gpio_word < 0) {  // non-used pixel marker.
+        ++ix;
+        continue;
+      }
+      const int run = PixelRunLength(first, x_end - ix);
+      SetPixelRun(*first, colors + ix, run);
+      ix += run;
+    }
+  }
+}
+
+// Collect pixels that are next to each other in the bitplane buffer
+// and are on the same color bits.
+/* static */ int Framebuffer::PixelRunLength(const PixelDesignator *first,
+                                             int max_count) {
+  if (max_count > kPixelRunLength) max_count = kPixelRunLength;
+  int run = 1;
+  while (run < max_count) {
+    const PixelDesignator *d = first + run;
+    if (d->gpio_word != first->gpio_word + run
+        || d->r_bit != first->r_bit || d->g_bit != first->g_bit
+        || d->b_bit != first->b_bit) {
+      break;
     }
+    ++run;
   }
+  return run;
 }
+
+// Write "count" pixels starting at the position of the designator "d".
+// All pixels are at consecutive columns and use the same color bits, so
+// instead of walking the bitplanes for each pixel, the whole run is
+// transposed into consecutive words of each plane.
+void Framebuffer::SetPixelRun(const PixelDesignator &d, const Color *colors,
+                              int count) {
+  if (compact_buffer_) {
+    SetCompactRun(d, colors, count);
+    return;
+  }
+  uint16_t red[kPixelRunLength], green[kPixelRunLength], blue[kPixelRunLength];
+  uint16_t lit = 0;
+  for (int i = 0; i < count; ++i) {
+    MapColors(colors[i].r, colors[i].g, colors[i].b,
+              &red[i], &green[i], &blue[i]);
+    lit |= red[i] | green[i] | blue[i];
+  }
+
+  MarkRowWritten(d.gpio_word);
+  MarkPlanesLit(d.gpio_word, lit);
+  internal::TransposeBitplanes(red, green, blue, count,
+                               d.r_bit, d.g_bit, d.b_bit, d.mask,
+                               kBitPlanes - pwm_bits_, kBitPlanes,
+                               bitplane_buffer_ + d.gpio_word, columns_);
+}
+
+// Same as SetPixelRun(), but for compact storage, in which each of the color
+// bits of the designator becomes a bit in the byte of its chain.
+void Framebuffer::SetCompactRun(const PixelDesignator &d, const Color *colors,
+                                int count) {
+  MarkRowWritten(d.gpio_word);
+  UpdateColorLookup();
+  const int chain = compact_chain_[__builtin_ctzll(d.r_bit | d.g_bit | d.b_bit)];
+  if (chain < 0) return;
+  const uint8_t r_bit = d.r_bit ? compact_bit_[__builtin_ctzll(d.r_bit)] : 0;
+  const uint8_t g_bit = d.g_bit ? compact_bit_[__builtin_ctzll(d.g_bit)] : 0;
+  const uint8_t b_bit = d.b_bit ? compact_bit_[__builtin_ctzll(d.b_bit)] : 0;
+  const uint8_t keep = ~(r_bit | g_bit | b_bit);
+  const uint8_t color_bits[8] = {
+    0, r_bit, g_bit, (uint8_t)(r_bit | g_bit),
+    b_bit, (uint8_t)(r_bit | b_bit), (uint8_t)(g_bit | b_bit),
+    (uint8_t)(r_bit | g_bit | b_bit)
+  };
+
+  const int min_bit_plane = kBitPlanes - pwm_bits_;
+  const int plane_stride = columns_ * parallel_;
+  uint8_t *pixel = compact_buffer_ + d.gpio_word * parallel_ + chain
+    + min_bit_plane * plane_stride;
+  uint16_t lit = 0;
+  for (int i = 0; i < count; ++i, pixel += parallel_) {
+    lit |= mapped_color_[colors[i].r] | mapped_color_[colors[i].g]
+      | mapped_color_[colors[i].b];
+    uint64_t pattern = plane_pattern_[colors[i].r]
+      | (plane_pattern_[colors[i].g] << 1) | (plane_pattern_[colors[i].b] << 2);
+    uint8_t *bits = pixel;
+    for (int plane = min_bit_plane; plane < kBitPlanes; ++plane) {
+      *bits = (*bits & keep) | color_bits[pattern & 0x7];
+      pattern >>= 3;
+      bits += plane_stride;
+    }
+  }
+  MarkPlanesLit(d.gpio_word, lit);
+}
+
 // Strange LED-mappings such as RBG or so are handled here.
 gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
                                                 const char *led_sequence,
@@ -768,8 +1245,7 @@ gpio_bits_t Framebuffer::GetGpioFromLedSequence(char col,
 void Framebuffer::InitDefaultDesignator(int x, int y, const char *seq,
                                         PixelDesignator *d) {
   const struct HardwareMapping &h = *hardware_mapping_;
-  gpio_bits_t *bits = ValueAt(y % double_rows_, x, 0);
-  d->gpio_word = bits - bitplane_buffer_;
+  d->gpio_word = (y % double_rows_) * (columns_ * kBitPlanes) + x;
   d->r_bit = d->g_bit = d->b_bit = 0;
   if (y < rows_) {
     if (y < double_rows_) {
@@ -842,23 +1318,165 @@ void Framebuffer::InitDefaultDesignator(int x, int y, const char *seq,
   d->mask = ~(d->r_bit | d->g_bit | d->b_bit);
 }
 
+/* static */ void Framebuffer::SetConversionPool(WorkerPool *pool) {
+  conversion_pool_ = pool;
+}
+
+/* static */ void Framebuffer::SetRefreshProfiler(RefreshProfiler *profiler) {
+  profiler_.store(profiler, std::memory_order_release);
+}
+
+void Framebuffer::SetRGBBackBuffer(bool enable) {
+  if (enable == (rgb_buffer_ != NULL)) return;
+  if (enable) {
+    rgb_width_ = width();
+    rgb_height_ = height();
+    rgb_buffer_ = new Color[rgb_width_ * rgb_height_];  // All black.
+    rgb_dirty_ = true;
+  } else {
+    Commit();
+    delete [] rgb_buffer_;
+    rgb_buffer_ = NULL;
+  }
+}
+
+// Converts a share of the double rows in each slice.
+class Framebuffer::ConversionTask : public WorkerPool::Task {
+public:
+  ConversionTask(Framebuffer *frame, const PixelRunPlan &plan, int slices)
+    : frame_(frame), plan_(plan), slices_(slices) {}
+
+  virtual void Run(int slice) {
+    const int double_rows = frame_->double_rows_;
+    frame_->ConvertDoubleRows(plan_,
+                              slice * double_rows / slices_,
+                              (slice + 1) * double_rows / slices_);
+  }
+
+private:
+  Framebuffer *const frame_;
+  const PixelRunPlan &plan_;
+  const int slices_;
+};
+
+void Framebuffer::Commit() {
+  if (rgb_buffer_ == NULL || !rgb_dirty_) return;
+  rgb_dirty_ = false;
+  PixelDesignatorMap *const map = *shared_mapper_;
+  if (map->width() != rgb_width_ || map->height() != rgb_height_) {
+    // Pixel mapper applied after the back buffer was enabled.
+    WritePixels(0, 0, rgb_width_, rgb_height_, rgb_buffer_);
+    return;
+  }
+
+  UpdateColorLookup();  // Before the workers read it concurrently.
+  const PixelRunPlan &plan
+    = map->GetRunPlan(double_rows_, columns_ * kBitPlanes);
+  if (conversion_pool_ == NULL) {
+    ConvertDoubleRows(plan, 0, double_rows_);
+    return;
+  }
+  // A few more slices than threads to even out uneven double rows.
+  const int slices = std::min(double_rows_,
+                              4 * (conversion_pool_->threads() + 1));
+  ConversionTask task(this, plan, slices);
+  conversion_pool_->Run(&task, slices);
+}
+
+void Framebuffer::ConvertDoubleRows(const PixelRunPlan &plan,
+                                    int first, int end) {
+  const PixelRun *run = plan.runs.data() + plan.double_row_start[first];
+  const PixelRun *const run_end = plan.runs.data() + plan.double_row_start[end];
+  for (/**/; run < run_end; ++run) {
+    SetPixelRun(*run->designator, rgb_buffer_ + run->offset, run->count);
+  }
+  // The whole rows were written; colors that became black are dropped here.
+  for (int row = first; row < end; ++row) UpdateLitPlanes(row);
+}
+
+bool Framebuffer::GetPixel(int x, int y,
+                           uint8_t *red, uint8_t *green, uint8_t *blue) const {
+  if (rgb_buffer_ == NULL) return false;
+  if (x < 0 || x >= rgb_width_ || y < 0 || y >= rgb_height_) return false;
+  const Color &c = rgb_buffer_[y * rgb_width_ + x];
+  *red = c.r;
+  *green = c.g;
+  *blue = c.b;
+  return true;
+}
+
 void Framebuffer::Serialize(const char **data, size_t *len) const {
+  if (compact_buffer_) {
+    *data = reinterpret_cast<const char*>(compact_buffer_);
+    *len = compact_size_;
+    return;
+  }
   *data = reinterpret_cast<const char*>(bitplane_buffer_);
   *len = buffer_size_;
 }
 
 bool Framebuffer::Deserialize(const char *data, size_t len) {
-  if (len != buffer_size_) return false;
-  memcpy(bitplane_buffer_, data, len);
+  // Accept both storage formats, whatever we currently use.
+  const size_t words = double_rows_ * columns_ * kBitPlanes;
+  if (len == buffer_size_) {
+    if (compact_buffer_) {
+      CompactWords(reinterpret_cast<const gpio_bits_t*>(data), words,
+                   compact_buffer_);
+    } else {
+      memcpy(bitplane_buffer_, data, len);
+    }
+  } else if (len == compact_size_) {
+    if (compact_buffer_) {
+      memcpy(compact_buffer_, data, len);
+    } else {
+      ExpandWords(reinterpret_cast<const uint8_t*>(data), words,
+                  bitplane_buffer_);
+    }
+  } else {
+    return false;
+  }
+  std::fill(row_version_, row_version_ + double_rows_, write_version_);
+  for (int row = 0; row < double_rows_; ++row) UpdateLitPlanes(row);
+  ContentChanged();
   return true;
 }
 
 void Framebuffer::CopyFrom(const Framebuffer *other) {
   if (other == this) return;
-  memcpy(bitplane_buffer_, other->bitplane_buffer_, buffer_size_);
+  // Only copy rows that differ. Afterwards, both share the versions of these
+  // rows, so "other" has to use a new version for further changes.
+  const int row_words = columns_ * kBitPlanes;
+  for (int row = 0; row < double_rows_; ++row) {
+    if (row_version_[row] == other->row_version_[row]) continue;
+    if (compact_buffer_ && other->compact_buffer_) {
+      memcpy(compact_buffer_ + row * row_words * parallel_,
+             other->compact_buffer_ + row * row_words * parallel_,
+             row_words * parallel_);
+    } else if (compact_buffer_) {
+      CompactWords(other->bitplane_buffer_ + row * row_words, row_words,
+                   compact_buffer_ + row * row_words * parallel_);
+    } else if (other->compact_buffer_) {
+      ExpandWords(other->compact_buffer_ + row * row_words * parallel_,
+                  row_words, bitplane_buffer_ + row * row_words);
+    } else {
+      memcpy(bitplane_buffer_ + row * row_words,
+             other->bitplane_buffer_ + row * row_words,
+             sizeof(*bitplane_buffer_) * row_words);
+    }
+    row_version_[row] = other->row_version_[row];
+    lit_planes_[row] = other->lit_planes_[row];
+  }
+  ContentChanged();
+  other->write_version_ = NewRowVersion();
+  if (rgb_buffer_ && other->rgb_buffer_
+      && rgb_width_ == other->rgb_width_ && rgb_height_ == other->rgb_height_) {
+    memcpy(rgb_buffer_, other->rgb_buffer_,
+           sizeof(Color) * rgb_width_ * rgb_height_);
+    rgb_dirty_ = other->rgb_dirty_;
+  }
 }
 
-void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
+gpio_bits_t Framebuffer::ColorClockMask() const {
   const struct HardwareMapping &h = *hardware_mapping_;
   gpio_bits_t color_clk_mask = 0;  // Mask of bits while clocking in.
   color_clk_mask |= h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2;
@@ -879,51 +1497,419 @@ void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit) {
   }
 
   color_clk_mask |= h.clock;
+  return color_clk_mask;
+}
+
+// The double row shown in the "row_loop"-th step of a frame.
+static inline int DoubleRowAt(int row_loop, int double_rows, int scan_mode) {
+  switch (scan_mode) {
+  case 0:  // progressive
+  default:
+    return row_loop;
+
+  case 1:  // interlaced
+    {
+      const int half_double = double_rows / 2;
+      return ((row_loop < half_double)
+              ? (row_loop << 1)
+              : ((row_loop - half_double) << 1) + 1);
+    }
+  }
+}
+
+// After the columns of a bitplane are clocked in: latch them and show.
+// The precompiled paths pass a NULL profiler, so the profiling code is
+// compiled out there.
+// A bitplane that is all black: nothing to clock in or strobe, but the
+// row still takes the time of the pulse, with the output off.
+inline void Framebuffer::ShowBlankPlane(int pulse) {
+  sOutputEnablePulser->WaitPulseFinished();
+  sOutputEnablePulser->SendDarkPulse(pulse);
+}
+
+inline void Framebuffer::ShowPlane(GPIO *io, int d_row, int pulse,
+                                   gpio_bits_t color_clk_mask,
+                                   RefreshProfiler *profiler) {
+  const struct HardwareMapping &h = *hardware_mapping_;
+  io->ClearBits(color_clk_mask);    // clock back to normal.
+  if (profiler) profiler->EndPhase(RefreshProfiler::kClockIn);
+
+  // OE of the previous row-data must be finished before strobe.
+  sOutputEnablePulser->WaitPulseFinished();
+  if (profiler) profiler->EndPhase(RefreshProfiler::kOutputEnableWait);
 
+  // Setting address and strobing needs to happen in dark time.
+  row_setter_->SetRowAddress(io, d_row);
+  if (profiler) profiler->EndPhase(RefreshProfiler::kAddressSet);
+
+  io->SetBits(h.strobe);   // Strobe in the previously clocked in row.
+  io->ClearBits(h.strobe);
+
+  // Now switch on for the sleep time necessary for that bit-plane.
+  sOutputEnablePulser->SendPulse(pulse);
+  if (profiler) {
+    profiler->EndPhase(RefreshProfiler::kStrobe);
+    profiler->EndPlane();
+  }
+}
+
+void Framebuffer::DumpToMatrix(GPIO *io, int pwm_low_bit,
+                               OutputCounts *counts) {
   // Depending if we do dithering, we might not always show the lowest bits.
   const int start_bit = std::max(pwm_low_bit, kBitPlanes - pwm_bits_);
+  OutputCounts local_counts;
+  if (counts == NULL) counts = &local_counts;
+  counts->bitplanes = double_rows_ * (kBitPlanes - start_bit);
+  counts->blank_bitplanes = 0;
+  counts->skipped_clock_outs = 0;
+  RefreshProfiler *const profiler = profiler_.load(std::memory_order_acquire);
+  if (profiler == NULL && program_.load() != NULL) {
+    MutexLock l(&program_lock_);
+    const OutputProgram *const program = program_.load();
+    if (program != NULL && ProgramMatches(*program, start_bit)) {
+      ReplayProgram(*program, io, start_bit, counts);
+      return;
+    }
+  }
+  if (profiler != NULL) profiler->BeginFrame();
+  if (split_bitplanes_) {
+    DumpSplitToMatrix(io, start_bit, counts, profiler);
+  } else if (profiler != NULL) {
+    DumpGenericToMatrix(io, start_bit, counts, profiler);
+  } else if (fixed_dump_ != NULL && compact_buffer_ == NULL) {
+    (this->*fixed_dump_)(io, start_bit, counts);
+  } else {
+    DumpGenericToMatrix(io, start_bit, counts, NULL);
+  }
+}
 
-  const uint8_t half_double = double_rows_/2;
-  for (uint8_t row_loop = 0; row_loop < double_rows_; ++row_loop) {
-    uint8_t d_row;
-    switch (scan_mode_) {
-    case 0:  // progressive
-    default:
-      d_row = row_loop;
-      break;
+// If the data is the same as clocked in last time, the shift registers
+// still have it. Comparing is cheap compared to the GPIO writes.
+static inline bool SameAsClocked(const void *data, const void *clocked,
+                                 size_t bytes) {
+  return clocked != NULL && memcmp(data, clocked, bytes) == 0;
+}
 
-    case 1:  // interlaced
-      d_row = ((row_loop < half_double)
-               ? (row_loop << 1)
-               : ((row_loop - half_double) << 1) + 1);
-    }
+void Framebuffer::DumpGenericToMatrix(GPIO *io, int start_bit,
+                                      OutputCounts *counts,
+                                      RefreshProfiler *profiler) {
+  const gpio_bits_t clock = hardware_mapping_->clock;
+  const gpio_bits_t color_clk_mask = ColorClockMask();
+  const size_t plane_bytes = compact_buffer_
+    ? columns_ * parallel_ : columns_ * sizeof(gpio_bits_t);
+  const void *clocked = NULL;  // Last data clocked in.
+  for (int row_loop = 0; row_loop < double_rows_; ++row_loop) {
+    const int d_row = DoubleRowAt(row_loop, double_rows_, scan_mode_);
+    const uint16_t lit = inverse_color_ ? kAllPlanes : lit_planes_[d_row];
 
     // Rows can't be switched very quickly without ghosting, so we do the
     // full PWM of one row before switching rows.
     for (int b = start_bit; b < kBitPlanes; ++b) {
-      gpio_bits_t *row_data = ValueAt(d_row, 0, b);
+      if ((lit & (1 << b)) == 0) {
+        // Nothing to show; the previous bitplane stays in the latches, but
+        // isn't shown again.
+        ++counts->blank_bitplanes;
+        ShowBlankPlane(b);
+        continue;
+      }
+      if (profiler) profiler->BeginPlane(d_row, b);
       // While the output enable is still on, we can already clock in the next
       // data.
-      for (int col = 0; col < columns_; ++col) {
-        const gpio_bits_t &out = *row_data++;
-        io->WriteMaskedBits(out, color_clk_mask);  // col + reset clock
-        io->SetBits(h.clock);               // Rising edge: clock color in.
+      if (compact_buffer_) {
+        const uint8_t *chains = CompactAt(d_row, 0, b);
+        if (SameAsClocked(chains, clocked, plane_bytes)) {
+          ++counts->skipped_clock_outs;
+        } else {
+          clocked = chains;
+          // Expand while clocking in; cheap compared to the GPIO writes.
+          for (int col = 0; col < columns_; ++col, chains += parallel_) {
+            io->WriteMaskedBits(ExpandCompact(chains), color_clk_mask);
+            io->SetBits(clock);
+          }
+        }
+      } else {
+        const gpio_bits_t *row_data = ValueAt(d_row, 0, b);
+        if (SameAsClocked(row_data, clocked, plane_bytes)) {
+          ++counts->skipped_clock_outs;
+        } else {
+          clocked = row_data;
+          for (int col = 0; col < columns_; ++col) {
+            const gpio_bits_t &out = *row_data++;
+            io->WriteMaskedBits(out, color_clk_mask);  // col + reset clock
+            io->SetBits(clock);                 // Rising edge: clock color in.
+          }
+        }
+      }
+      ShowPlane(io, d_row, b, color_clk_mask, profiler);
+    }
+  }
+}
+
+// Same as DumpGenericToMatrix(), but with the bitplanes in the passes of
+// split_schedule_.
+void Framebuffer::DumpSplitToMatrix(GPIO *io, int start_bit,
+                                    OutputCounts *counts,
+                                    RefreshProfiler *profiler) {
+  const gpio_bits_t clock = hardware_mapping_->clock;
+  const gpio_bits_t color_clk_mask = ColorClockMask();
+  const size_t plane_bytes = compact_buffer_
+    ? columns_ * parallel_ : columns_ * sizeof(gpio_bits_t);
+  const SplitSchedule &schedule = split_schedule_[start_bit];
+  const void *clocked = NULL;  // Last data clocked in.
+  counts->bitplanes = 0;
+  for (int pass = 0; pass < kSplitPasses; ++pass) {
+    const std::vector<SplitPulse> &pulses = schedule[pass];
+    counts->bitplanes += double_rows_ * pulses.size();
+    for (int row_loop = 0; row_loop < double_rows_; ++row_loop) {
+      const int d_row = DoubleRowAt(row_loop, double_rows_, scan_mode_);
+      const uint16_t lit = inverse_color_ ? kAllPlanes : lit_planes_[d_row];
+      for (size_t i = 0; i < pulses.size(); ++i) {
+        const int b = pulses[i].plane;
+        if ((lit & (1 << b)) == 0) {
+          ++counts->blank_bitplanes;
+          ShowBlankPlane(pulses[i].pulse);
+          continue;
+        }
+        if (profiler) profiler->BeginPlane(d_row, b);
+        if (compact_buffer_) {
+          const uint8_t *chains = CompactAt(d_row, 0, b);
+          if (SameAsClocked(chains, clocked, plane_bytes)) {
+            ++counts->skipped_clock_outs;
+          } else {
+            clocked = chains;
+            for (int col = 0; col < columns_; ++col, chains += parallel_) {
+              io->WriteMaskedBits(ExpandCompact(chains), color_clk_mask);
+              io->SetBits(clock);
+            }
+          }
+        } else {
+          const gpio_bits_t *row_data = ValueAt(d_row, 0, b);
+          if (SameAsClocked(row_data, clocked, plane_bytes)) {
+            ++counts->skipped_clock_outs;
+          } else {
+            clocked = row_data;
+            for (int col = 0; col < columns_; ++col) {
+              io->WriteMaskedBits(row_data[col], color_clk_mask);
+              io->SetBits(clock);
+            }
+          }
+        }
+        ShowPlane(io, d_row, pulses[i].pulse, color_clk_mask, profiler);
+      }
+    }
+  }
+}
+
+void Framebuffer::CompileOutput() {
+  RecomputeLitPlanes();  // Blank bitplanes are compiled in.
+  OutputProgram *program = spare_program_;
+  spare_program_ = NULL;
+  if (program == NULL) program = new OutputProgram();
+  // Before reading the content: changes while compiling invalidate it.
+  program->generation = content_generation_.load(std::memory_order_relaxed);
+  program->pwm_bits = pwm_bits_;
+  program->split = split_bitplanes_;
+  program->color_clk_mask = ColorClockMask();
+  program->steps.clear();
+  program->words.clear();
+  std::fill(program->outputs, program->outputs + kBitPlanes, 0);
+  std::fill(program->blank, program->blank + kBitPlanes, 0);
+
+  // Without splitting, one pass with all bitplanes in a row.
+  const int start_bit = kBitPlanes - pwm_bits_;
+  SplitSchedule single_pass;
+  const SplitSchedule *schedule = &split_schedule_[start_bit];
+  if (!split_bitplanes_) {
+    single_pass.resize(1);
+    for (int b = start_bit; b < kBitPlanes; ++b) {
+      const SplitPulse pulse = { (uint8_t) b, (uint8_t) b };
+      single_pass[0].push_back(pulse);
+    }
+    schedule = &single_pass;
+  }
+
+  const gpio_bits_t mask = program->color_clk_mask;
+  const size_t plane_bytes = compact_buffer_
+    ? columns_ * parallel_ : columns_ * sizeof(gpio_bits_t);
+  const void *clocked = NULL;  // Last data clocked in.
+  uint32_t clocked_word = 0;   // ... and where it is in program->words.
+  for (size_t pass = 0; pass < schedule->size(); ++pass) {
+    const std::vector<SplitPulse> &pulses = (*schedule)[pass];
+    for (int row_loop = 0; row_loop < double_rows_; ++row_loop) {
+      const int d_row = DoubleRowAt(row_loop, double_rows_, scan_mode_);
+      const uint16_t lit = inverse_color_ ? kAllPlanes : lit_planes_[d_row];
+      for (size_t i = 0; i < pulses.size(); ++i) {
+        const int b = pulses[i].plane;
+        ++program->outputs[b];
+        OutputProgram::Step step;
+        step.row = d_row;
+        step.plane = b;
+        step.pulse = pulses[i].pulse;
+        step.blank = ((lit & (1 << b)) == 0);
+        if (step.blank) {
+          ++program->blank[b];
+          step.first_word = 0;
+          step.same_as_previous = false;
+          program->steps.push_back(step);
+          continue;
+        }
+        const void *data = compact_buffer_
+          ? (const void*) CompactAt(d_row, 0, b)
+          : (const void*) ValueAt(d_row, 0, b);
+        step.same_as_previous = SameAsClocked(data, clocked, plane_bytes);
+        if (step.same_as_previous) {
+          step.first_word = clocked_word;
+        } else {
+          clocked = data;
+          clocked_word = step.first_word = program->words.size();
+          for (int col = 0; col < columns_; ++col) {
+            const gpio_bits_t value = compact_buffer_
+              ? ExpandCompact(CompactAt(d_row, col, b))
+              : *ValueAt(d_row, col, b);
+            const OutputProgram::Word word = { ~value & mask, value & mask };
+            program->words.push_back(word);
+          }
+        }
+        program->steps.push_back(step);
       }
-      io->ClearBits(color_clk_mask);    // clock back to normal.
+    }
+  }
+
+  // The refresh thread might still replay the previous program; once we
+  // have the lock, it is done with it and will only see the new one.
+  OutputProgram *previous;
+  {
+    MutexLock l(&program_lock_);
+    previous = program_.exchange(program);
+  }
+  spare_program_ = previous;
+}
+
+void Framebuffer::FreeOutputPrograms() {
+  OutputProgram *program;
+  {
+    MutexLock l(&program_lock_);
+    program = program_.exchange(NULL);
+  }
+  delete program;
+  delete spare_program_;
+  spare_program_ = NULL;
+}
 
-      // OE of the previous row-data must be finished before strobe.
-      sOutputEnablePulser->WaitPulseFinished();
+bool Framebuffer::ProgramMatches(const OutputProgram &program,
+                                 int start_bit) const {
+  if (program.generation
+      != content_generation_.load(std::memory_order_relaxed)) return false;
+  if (program.pwm_bits != pwm_bits_ || program.split != split_bitplanes_) {
+    return false;
+  }
+  // Skipping the low bitplanes (dithering) is possible with a single pass;
+  // the split schedule would be a different one.
+  return !program.split || start_bit == kBitPlanes - program.pwm_bits;
+}
 
-      // Setting address and strobing needs to happen in dark time.
-      row_setter_->SetRowAddress(io, d_row);
+void Framebuffer::ReplayProgram(const OutputProgram &program, GPIO *io,
+                                int start_bit, OutputCounts *counts) {
+  const gpio_bits_t clock = hardware_mapping_->clock;
+  const gpio_bits_t color_clk_mask = program.color_clk_mask;
+  counts->bitplanes = 0;
+  for (int b = start_bit; b < kBitPlanes; ++b) {
+    counts->bitplanes += program.outputs[b];
+    counts->blank_bitplanes += program.blank[b];
+  }
+  const OutputProgram::Word *const words = program.words.data();
+  bool previous_shown = false;  // Shift registers have previous step data.
+  for (size_t i = 0; i < program.steps.size(); ++i) {
+    const OutputProgram::Step &step = program.steps[i];
+    if (step.plane < start_bit) {
+      if (!step.blank) previous_shown = false;
+      continue;
+    }
+    if (step.blank) {
+      // The shift registers keep the data of the step before.
+      ShowBlankPlane(step.pulse);
+      continue;
+    }
+    if (step.same_as_previous && previous_shown) {
+      ++counts->skipped_clock_outs;
+    } else {
+      const OutputProgram::Word *word = words + step.first_word;
+      for (int col = 0; col < columns_; ++col, ++word) {
+        io->WriteClearSetBits(word->clear, word->set);
+        io->SetBits(clock);
+      }
+    }
+    previous_shown = true;
+    ShowPlane(io, step.row, step.pulse, color_clk_mask, NULL);
+  }
+}
 
-      io->SetBits(h.strobe);   // Strobe in the previously clocked in row.
-      io->ClearBits(h.strobe);
+// Same as DumpGenericToMatrix() for the full bitplane buffer, but with the
+// geometry known at compile time, so that loops have constant bounds and
+// the scan mode is resolved at compile time.
+template <int kColumns, int kDoubleRows, int kScanMode>
+void Framebuffer::DumpFixedToMatrix(GPIO *io, int start_bit,
+                                    OutputCounts *counts) {
+  const gpio_bits_t clock = hardware_mapping_->clock;
+  const gpio_bits_t color_clk_mask = ColorClockMask();
+  const gpio_bits_t *clocked = NULL;
+  for (int row_loop = 0; row_loop < kDoubleRows; ++row_loop) {
+    const int d_row = DoubleRowAt(row_loop, kDoubleRows, kScanMode);
+    const uint16_t lit = inverse_color_ ? kAllPlanes : lit_planes_[d_row];
+    const gpio_bits_t *row_data = bitplane_buffer_
+      + (d_row * kBitPlanes + start_bit) * kColumns;
+    for (int b = start_bit; b < kBitPlanes; ++b, row_data += kColumns) {
+      if ((lit & (1 << b)) == 0) {
+        ++counts->blank_bitplanes;
+        ShowBlankPlane(b);
+        continue;
+      }
+      if (SameAsClocked(row_data, clocked, kColumns * sizeof(*row_data))) {
+        ++counts->skipped_clock_outs;
+      } else {
+        clocked = row_data;
+        for (int col = 0; col < kColumns; ++col) {
+          io->WriteMaskedBits(row_data[col], color_clk_mask);
+          io->SetBits(clock);
+        }
+      }
+      ShowPlane(io, d_row, b, color_clk_mask, NULL);
+    }
+  }
+}
 
-      // Now switch on for the sleep time necessary for that bit-plane.
-      sOutputEnablePulser->SendPulse(b);
+// Geometries with a precompiled output path. Columns are panel columns
+// times chain length, double rows are panel rows / 2.
+#define FIXED_DUMP(columns, double_rows)                                \
+  { columns, double_rows, 0,                                            \
+    &Framebuffer::DumpFixedToMatrix<columns, double_rows, 0> },         \
+  { columns, double_rows, 1,                                            \
+    &Framebuffer::DumpFixedToMatrix<columns, double_rows, 1> }
+
+/* static */ Framebuffer::DumpFunction
+Framebuffer::FixedDumpFunction(int columns, int double_rows, int scan_mode) {
+  static const struct {
+    int columns;
+    int double_rows;
+    int scan_mode;
+    DumpFunction dump;
+  } kFixedDumps[] = {
+    FIXED_DUMP(32, 8),     // 32x16
+    FIXED_DUMP(32, 16),    // 32x32
+    FIXED_DUMP(64, 16),    // 64x32
+    FIXED_DUMP(64, 32),    // 64x64
+    FIXED_DUMP(128, 16),   // 2 x 64x32
+    FIXED_DUMP(128, 32),   // 2 x 64x64
+  };
+  for (size_t i = 0; i < sizeof(kFixedDumps) / sizeof(kFixedDumps[0]); ++i) {
+    if (kFixedDumps[i].columns == columns
+        && kFixedDumps[i].double_rows == double_rows
+        && kFixedDumps[i].scan_mode == scan_mode) {
+      return kFixedDumps[i].dump;
     }
   }
+  return NULL;
 }
+#undef FIXED_DUMP
 }  // namespace internal
 }  // namespace rgb_matrix
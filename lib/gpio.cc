@@ -20,6 +20,7 @@
 
 #include <assert.h>
 #include <fcntl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +28,9 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+
 /*
  * nanosleep() takes longer than requested because of OS jitter.
  * In about 99.9% of the cases, this is <= 25 microcseconds on
@@ -34,7 +38,7 @@
  * we substract this value whenever we do nanosleep(); the remaining time
  * we then busy wait to get a good accurate result.
  *
- * You can measure the overhead using DEBUG_SLEEP_JITTER below.
+ * You can measure the overhead with RGBMatrix::SetSleepJitterTracking().
  *
  * Note: A higher value here will result in more CPU use because of more busy
  * waiting inching towards the real value (for all the cases that nanosleep()
@@ -52,15 +56,6 @@
  */
 #define MINIMUM_NANOSLEEP_TIME_US 5
 
-/* In order to determine useful values for above, set this to 1 and use the
- * hardware pin-pulser.
- * It will output a histogram atexit() of how much how often we were over
- * the requested time.
- * (The full histogram will be shifted by the EMPIRICAL_NANOSLEEP_OVERHEAD_US
- *  value above. To get a full histogram of OS overhead, set it to 0 first).
- */
-#define DEBUG_SLEEP_JITTER 0
-
 // Raspberry 1 and 2 have different base addresses for the periphery
 #define BCM2708_PERI_BASE        0x20000000
 #define BCM2709_PERI_BASE        0x3F000000
@@ -144,7 +139,7 @@ static bool LinuxHasModuleLoaded(const char *name) {
 #define GPIO_BIT(x) (1ull << x)
 
 GPIO::GPIO() : output_bits_(0), input_bits_(0), reserved_bits_(0),
-               slowdown_(1)
+               slowdown_(1), backend_(NULL)
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
              , uses_64_bit_(false)
 #endif
@@ -153,7 +148,7 @@ GPIO::GPIO() : output_bits_(0), input_bits_(0), reserved_bits_(0),
 
 gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
                               bool adafruit_pwm_transition_hack_needed) {
-  if (s_GPIO_registers == NULL) {
+  if (s_GPIO_registers == NULL && backend_ == NULL) {
     fprintf(stderr, "Attempt to init outputs but not yet Init()-ialized.\n");
     return 0;
   }
@@ -168,8 +163,10 @@ gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
   // can switch between the two modes "adafruit-hat" and "adafruit-hat-pwm"
   // without trouble.
   if (adafruit_pwm_transition_hack_needed) {
-    INP_GPIO(4);
-    INP_GPIO(18);
+    if (backend_ == NULL) {
+      INP_GPIO(4);
+      INP_GPIO(18);
+    }
     // Even with PWM enabled, GPIO4 still can not be used, because it is
     // now connected to the GPIO18 and thus must stay an input.
     // So reserve this bit if it is not set in outputs.
@@ -193,7 +190,7 @@ gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
 #else
   const int kMaxAvailableBit = 31;
 #endif
-  for (int b = 0; b <= kMaxAvailableBit; ++b) {
+  for (int b = 0; b <= kMaxAvailableBit && backend_ == NULL; ++b) {
     if (outputs & GPIO_BIT(b)) {
       INP_GPIO(b);   // for writing, we first need to set as input.
       OUT_GPIO(b);
@@ -204,7 +201,7 @@ gpio_bits_t GPIO::InitOutputs(gpio_bits_t outputs,
 }
 
 gpio_bits_t GPIO::RequestInputs(gpio_bits_t inputs) {
-  if (s_GPIO_registers == NULL) {
+  if (s_GPIO_registers == NULL && backend_ == NULL) {
     fprintf(stderr, "Attempt to init inputs but not yet Init()-ialized.\n");
     return 0;
   }
@@ -216,7 +213,7 @@ gpio_bits_t GPIO::RequestInputs(gpio_bits_t inputs) {
 #else
   const int kMaxAvailableBit = 31;
 #endif
-  for (int b = 0; b <= kMaxAvailableBit; ++b) {
+  for (int b = 0; b <= kMaxAvailableBit && backend_ == NULL; ++b) {
     if (inputs & GPIO_BIT(b)) {
       INP_GPIO(b);
     }
@@ -291,14 +288,21 @@ static uint32_t ReadRevisionFromDeviceTree() {
   return read_be32(buffer);
 }
 
+static uint32_t DeterminePiRevision() {
+  const uint32_t pi_revision = ReadRevisionFromProcCpuinfo();
+  return pi_revision != 0 ? pi_revision : ReadRevisionFromDeviceTree();
+}
+
+static uint32_t GetPiRevision() {
+  static uint32_t pi_revision = DeterminePiRevision();
+  return pi_revision;
+}
+
 static RaspberryPiModel DetermineRaspberryModel() {
-  uint32_t pi_revision = ReadRevisionFromProcCpuinfo();
+  const uint32_t pi_revision = GetPiRevision();
   if (pi_revision == 0) {
-    pi_revision = ReadRevisionFromDeviceTree();
-    if (pi_revision == 0) {
-      fprintf(stderr, "Unknown Revision: Could not determine Pi model\n");
-      return PI_MODEL_3;  // safe guess fallback.
-    }
+    fprintf(stderr, "Unknown Revision: Could not determine Pi model\n");
+    return PI_MODEL_3;  // safe guess fallback.
   }
 
   // https://www.raspberrypi.com/documentation/computers/raspberry-pi.html#raspberry-pi-revision-codes
@@ -425,6 +429,13 @@ bool GPIO::Init(int slowdown) {
   return true;
 }
 
+bool GPIO::Init(GPIOBackend *backend) {
+  if (backend == NULL) return false;
+  backend_ = backend;
+  slowdown_ = 0;  // No registers to wait for.
+  return true;
+}
+
 bool GPIO::IsPi4() {
   return GetPiModel() == PI_MODEL_4;
 }
@@ -450,7 +461,8 @@ class TimerBasedPinPulser : public PinPulser {
 public:
   TimerBasedPinPulser(GPIO *io, gpio_bits_t bits,
                       const std::vector<int> &nano_specs)
-    : io_(io), bits_(bits), nano_specs_(nano_specs) {
+    : io_(io), bits_(bits), nano_specs_(nano_specs),
+      scaled_specs_(nano_specs) {
     if (!s_Timer1Mhz) {
       fprintf(stderr, "FYI: not running as root which means we can't properly "
               "control timing unless this is a real-time kernel. Expect color "
@@ -459,15 +471,60 @@ public:
   }
 
   virtual void SendPulse(int time_spec_number) {
+    if (scaled_specs_[time_spec_number] == 0) return;
     io_->ClearBits(bits_);
-    Timers::sleep_nanos(nano_specs_[time_spec_number]);
+    Timers::sleep_nanos(scaled_specs_[time_spec_number]);
     io_->SetBits(bits_);
   }
 
+  virtual void SendDarkPulse(int time_spec_number) {
+    if (scaled_specs_[time_spec_number] == 0) return;
+    Timers::sleep_nanos(scaled_specs_[time_spec_number]);
+  }
+
+  virtual void SetPulseScale(int permille) {
+    for (size_t i = 0; i < nano_specs_.size(); ++i) {
+      scaled_specs_[i] = (int64_t)nano_specs_[i] * permille / 1000;
+    }
+  }
+
 private:
   GPIO *const io_;
   const gpio_bits_t bits_;
   const std::vector<int> nano_specs_;
+  std::vector<int> scaled_specs_;
+};
+
+// Pulses for a GPIOBackend: it gets the length instead of waiting for it.
+class BackendPinPulser : public PinPulser {
+public:
+  BackendPinPulser(GPIOBackend *backend, gpio_bits_t bits,
+                   const std::vector<int> &nano_specs)
+    : backend_(backend), bits_(bits), nano_specs_(nano_specs),
+      scaled_specs_(nano_specs) {
+  }
+
+  virtual void SendPulse(int time_spec_number) {
+    if (scaled_specs_[time_spec_number] == 0) return;
+    backend_->Pulse(bits_, scaled_specs_[time_spec_number]);
+  }
+
+  virtual void SendDarkPulse(int time_spec_number) {
+    if (scaled_specs_[time_spec_number] == 0) return;
+    backend_->Pulse(0, scaled_specs_[time_spec_number]);
+  }
+
+  virtual void SetPulseScale(int permille) {
+    for (size_t i = 0; i < nano_specs_.size(); ++i) {
+      scaled_specs_[i] = (int64_t)nano_specs_[i] * permille / 1000;
+    }
+  }
+
+private:
+  GPIOBackend *const backend_;
+  const gpio_bits_t bits_;
+  const std::vector<int> nano_specs_;
+  std::vector<int> scaled_specs_;
 };
 
 // Check that 3 shows up in isolcpus
@@ -477,11 +534,44 @@ static bool HasIsolCPUs() {
   return index(buf, '3') != NULL;
 }
 
-static void busy_wait_nanos_rpi_1(long nanos);
-static void busy_wait_nanos_rpi_2(long nanos);
-static void busy_wait_nanos_rpi_3(long nanos);
-static void busy_wait_nanos_rpi_4(long nanos);
-static void (*busy_wait_impl)(long) = busy_wait_nanos_rpi_3;
+// How many iterations of the busy-wait loop make up a given time depends on
+// the CPU, its clock and the governor, so it is calibrated at startup (see
+// CalibrateBusyWait()). Until then, or if that fails, the values determined
+// empirically for each model are used.
+struct BusyWaitTiming {
+  uint32_t loops_per_1024ns;
+  uint32_t overhead_ns;  // Time of a busy-wait call besides the loop.
+};
+static const BusyWaitTiming kEmpiricalBusyWait[] = {
+  { 256, 70 },   // PI_MODEL_1, 700Mhz
+  { 931, 20 },   // PI_MODEL_2, 900Mhz
+  { 1403, 15 },  // PI_MODEL_3
+  { 776, 5 },    // PI_MODEL_4. Interesting, the Pi4 is _slower_ than the Pi3?
+};
+static BusyWaitTiming s_busy_wait = kEmpiricalBusyWait[PI_MODEL_3];
+// The Pi 1 value is for a loop with a nop, as it was measured with; the
+// others for an empty loop. Calibration measures whichever loop is used.
+static bool s_busy_wait_nop = false;
+
+// Where the calibration is kept, so that it only needs to be done once.
+#define BUSY_WAIT_CACHE_FILE "/var/cache/rpi-rgb-led-matrix-busy-wait"
+
+static void busy_wait_nanos(long nanos);
+static void CalibrateBusyWait();
+
+// Histograms of how many microseconds sleeps overshot beyond what the
+// busy-waiting after them can correct; see SetSleepJitterTracking().
+// In order to determine useful values for EMPIRICAL_NANOSLEEP_OVERHEAD_US,
+// watch these with the hardware pin-pulser.
+static std::atomic<bool> s_track_jitter(false);
+static std::atomic<uint32_t> s_sleep_jitter[kSleepJitterBuckets];
+static std::atomic<uint32_t> s_pulse_wait_jitter[kSleepJitterBuckets];
+
+static void CountJitter(std::atomic<uint32_t> *histogram, long overshoot_us) {
+  if (overshoot_us < 0) overshoot_us = 0;
+  if (overshoot_us >= kSleepJitterBuckets) overshoot_us = kSleepJitterBuckets-1;
+  histogram[overshoot_us].fetch_add(1, std::memory_order_relaxed);
+}
 
 // Best effort write to file. Used to set kernel parameters.
 static void WriteTo(const char *filename, const char *str) {
@@ -508,18 +598,15 @@ bool Timers::Init() {
   if (!mmap_all_bcm_registers_once())
     return false;
 
-  // Choose the busy-wait loop that fits our Pi.
-  switch (GetPiModel()) {
-  case PI_MODEL_1: busy_wait_impl = busy_wait_nanos_rpi_1; break;
-  case PI_MODEL_2: busy_wait_impl = busy_wait_nanos_rpi_2; break;
-  case PI_MODEL_3: busy_wait_impl = busy_wait_nanos_rpi_3; break;
-  case PI_MODEL_4: busy_wait_impl = busy_wait_nanos_rpi_4; break;
-  }
+  s_busy_wait = kEmpiricalBusyWait[GetPiModel()];
+  s_busy_wait_nop = (GetPiModel() == PI_MODEL_1);
 
   DisableRealtimeThrottling();
   // If we have it, we run the update thread on core3. No perf-compromises:
   WriteTo("/sys/devices/system/cpu/cpu3/cpufreq/scaling_governor",
           "performance");
+  // With the governor chosen: the busy-wait timing depends on it.
+  CalibrateBusyWait();
 
   if (GetPiModel() != PI_MODEL_1 && !HasIsolCPUs()) {
     fprintf(stderr, "Suggestion: to slightly improve display update, add\n\tisolcpus=3\n"
@@ -563,6 +650,9 @@ void Timers::sleep_nanos(long nanos) {
       nanosleep(&sleep_time, NULL);
       const uint32_t after = *s_Timer1Mhz;
       const long nanoseconds_passed = 1000 * (uint32_t)(after - before);
+      if (s_track_jitter.load(std::memory_order_relaxed)) {
+        CountJitter(s_sleep_jitter, (nanoseconds_passed - nanos) / 1000);
+      }
       if (nanoseconds_passed > nanos) {
         return;  // darn, missed it.
       } else {
@@ -575,64 +665,149 @@ void Timers::sleep_nanos(long nanos) {
     if (nanos > (EMPIRICAL_NANOSLEEP_OVERHEAD_US + MINIMUM_NANOSLEEP_TIME_US)*1000) {
       struct timespec sleep_time
         = { 0, nanos - EMPIRICAL_NANOSLEEP_OVERHEAD_US*1000 };
+      if (s_track_jitter.load(std::memory_order_relaxed)) {
+        const uint32_t before = GetMicrosecondCounter();
+        nanosleep(&sleep_time, NULL);
+        const uint32_t after = GetMicrosecondCounter();
+        CountJitter(s_sleep_jitter, (long)(after - before) - nanos / 1000);
+        return;
+      }
       nanosleep(&sleep_time, NULL);
       return;
     }
   }
 
-  busy_wait_impl(nanos);  // Use model-specific busy-loop for remaining time.
+  busy_wait_nanos(nanos);  // Use calibrated busy-loop for remaining time.
 }
 
-static void busy_wait_nanos_rpi_1(long nanos) {
-  if (nanos < 70) return;
-  // The following loop is determined empirically on a 700Mhz RPi
-  for (uint32_t i = (nanos - 70) >> 2; i != 0; --i) {
-    asm("nop");
+static void busy_wait_nanos(long nanos) {
+  if (nanos <= (long)s_busy_wait.overhead_ns) return;
+  const uint64_t loop_nanos = nanos - s_busy_wait.overhead_ns;
+  const uint32_t loops = (loop_nanos * s_busy_wait.loops_per_1024ns) >> 10;
+  if (s_busy_wait_nop) {
+    for (uint32_t i = loops; i != 0; --i) {
+      asm("nop");
+    }
+  } else {
+    for (uint32_t i = loops; i != 0; --i) {
+      asm("");
+    }
   }
 }
 
-static void busy_wait_nanos_rpi_2(long nanos) {
-  if (nanos < 20) return;
-  // The following loop is determined empirically on a 900Mhz RPi 2
-  for (uint32_t i = (nanos - 20) * 100 / 110; i != 0; --i) {
-    asm("");
+static uint64_t RawNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Best time of several runs of busy_wait_nanos(), as some will be
+// interrupted.
+static uint64_t TimeBusyWait(long nanos) {
+  uint64_t best = UINT64_MAX;
+  for (int run = 0; run < 25; ++run) {
+    const uint64_t start = RawNanos();
+    busy_wait_nanos(nanos);
+    best = std::min(best, RawNanos() - start);
   }
+  return best;
 }
 
-static void busy_wait_nanos_rpi_3(long nanos) {
-  if (nanos < 20) return;
-  for (uint32_t i = (nanos - 15) * 100 / 73; i != 0; --i) {
-    asm("");
+// Measure the busy-wait loop against the clock. The difference of a short
+// and a long wait gives the time per iteration, the rest of the short one
+// the overhead.
+static bool MeasureBusyWait(BusyWaitTiming *timing) {
+  static const long kShortLoops = 1000;
+  static const long kLongLoops = 100000;
+  const BusyWaitTiming previous = s_busy_wait;
+  const BusyWaitTiming one_per_nanosecond = { 1024, 0 };
+  s_busy_wait = one_per_nanosecond;
+  uint64_t clock_ns = UINT64_MAX;  // Time to read the clock itself.
+  for (int run = 0; run < 25; ++run) {
+    const uint64_t start = RawNanos();
+    clock_ns = std::min(clock_ns, RawNanos() - start);
   }
+  TimeBusyWait(kLongLoops);  // Warm up, e.g. let the CPU clock go up.
+  const uint64_t short_ns = TimeBusyWait(kShortLoops);
+  const uint64_t long_ns = TimeBusyWait(kLongLoops);
+  s_busy_wait = previous;
+
+  if (long_ns <= short_ns) return false;
+  const double ns_per_loop = (double)(long_ns - short_ns)
+    / (kLongLoops - kShortLoops);
+  const double overhead_ns = short_ns - clock_ns - kShortLoops * ns_per_loop;
+  timing->loops_per_1024ns = lround(1024 / ns_per_loop);
+  timing->overhead_ns = overhead_ns > 0 ? lround(overhead_ns) : 0;
+  return timing->loops_per_1024ns > 0;
 }
 
-static void busy_wait_nanos_rpi_4(long nanos) {
-  if (nanos < 20) return;
-  // Interesting, the Pi4 is _slower_ than the Pi3 ? At least for this busy loop
-  for (uint32_t i = (nanos - 5) * 100 / 132; i != 0; --i) {
-    asm("");
+// The calibration is valid for the board, its clock and the governor of the
+// core we refresh on.
+static void GetBusyWaitKey(char *key, size_t size) {
+  const int cpu = GetNumCores() - 1;
+  char path[128];
+  char max_freq[32];
+  char governor[32];
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_max_freq", cpu);
+  ReadTextFileToBuffer(max_freq, sizeof(max_freq), path);
+  max_freq[strcspn(max_freq, " \n")] = '\0';
+  snprintf(path, sizeof(path),
+           "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+  ReadTextFileToBuffer(governor, sizeof(governor), path);
+  governor[strcspn(governor, " \n")] = '\0';
+  snprintf(key, size, "%08x/%s/%s", GetPiRevision(),
+           max_freq[0] ? max_freq : "-", governor[0] ? governor : "-");
+}
+
+static bool ReadBusyWaitCache(const char *key, BusyWaitTiming *timing) {
+  char buffer[256];
+  if (ReadTextFileToBuffer(buffer, sizeof(buffer), BUSY_WAIT_CACHE_FILE) < 0)
+    return false;
+  char cached_key[128];
+  unsigned int loops, overhead;
+  if (sscanf(buffer, "%127s %u %u", cached_key, &loops, &overhead) != 3
+      || strcmp(cached_key, key) != 0 || loops == 0) {
+    return false;
   }
+  timing->loops_per_1024ns = loops;
+  timing->overhead_ns = overhead;
+  return true;
 }
 
-#if DEBUG_SLEEP_JITTER
-static int overshoot_histogram_us[256] = {0};
-static void print_overshoot_histogram() {
-  fprintf(stderr, "Overshoot histogram >= empirical overhead of %dus\n"
-          "%6s | %7s | %7s\n",
-          JitterAllowanceMicroseconds(), "usec", "count", "accum");
-  int total_count = 0;
-  for (int i = 0; i < 256; ++i) total_count += overshoot_histogram_us[i];
-  int running_count = 0;
-  for (int us = 0; us < 256; ++us) {
-    const int count = overshoot_histogram_us[us];
-    if (count > 0) {
-      running_count += count;
-      fprintf(stderr, "%s%3dus: %8d %7.3f%%\n", (us == 0) ? "<=" : " +",
-              us, count, 100.0 * running_count / total_count);
-    }
+// Best effort; if we can't write it, we calibrate again next time.
+static void WriteBusyWaitCache(const char *key, const BusyWaitTiming &timing) {
+  char line[256];
+  const int len = snprintf(line, sizeof(line), "%s %u %u\n", key,
+                           timing.loops_per_1024ns, timing.overhead_ns);
+  const int fd = open(BUSY_WAIT_CACHE_FILE, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0) return;
+  (void) write(fd, line, len);  // Best effort. Ignore return value.
+  close(fd);
+}
+
+static bool CompareLoops(const BusyWaitTiming &a, const BusyWaitTiming &b) {
+  return a.loops_per_1024ns < b.loops_per_1024ns;
+}
+
+static void CalibrateBusyWait() {
+  char key[128];
+  GetBusyWaitKey(key, sizeof(key));
+  BusyWaitTiming timing;
+  if (ReadBusyWaitCache(key, &timing)) {
+    s_busy_wait = timing;
+    return;
+  }
+  // Median of a few measurements, in case one was disturbed throughout.
+  BusyWaitTiming measured[5];
+  const int count = sizeof(measured) / sizeof(measured[0]);
+  for (int i = 0; i < count; ++i) {
+    if (!MeasureBusyWait(&measured[i])) return;  // Keep the empirical values.
   }
+  std::sort(measured, measured + count, CompareLoops);
+  s_busy_wait = measured[count / 2];
+  WriteBusyWaitCache(key, s_busy_wait);
 }
-#endif
 
 // A PinPulser that uses the PWM hardware to create accurate pulses.
 // It only works on GPIO-12 or 18 though.
@@ -662,14 +837,10 @@ public:
   }
 
   HardwarePinPulser(gpio_bits_t pins, const std::vector<int> &specs)
-    : triggered_(false) {
+    : specs_(specs), triggered_(false) {
     assert(CanHandle(pins));
     assert(s_CLK_registers && s_PWM_registers && s_Timer1Mhz);
 
-#if DEBUG_SLEEP_JITTER
-    atexit(print_overshoot_histogram);
-#endif
-
     if (LinuxHasModuleLoaded("snd_bcm2835")) {
       fprintf(stderr,
               "\n%s=== snd_bcm2835: found that the Pi sound module is loaded. ===%s\n"
@@ -683,12 +854,17 @@ public:
       exit(1);
     }
 
-    for (size_t i = 0; i < specs.size(); ++i) {
-      // Hints how long to nanosleep, already corrected for system overhead.
-      sleep_hints_us_.push_back(specs[i]/1000 - JitterAllowanceMicroseconds());
-    }
-
+    // Unscaled pulses use a clock of half the shortest pulse. Scaled
+    // pulses need a clock kPulseScaleResolution times faster than that to
+    // keep their proportions.
     const int base = specs[0];
+    coarse_divider_ = (base/2) / PWM_BASE_TIME_NS;
+    fine_divider_ = std::max<uint32_t>(coarse_divider_ / kPulseScaleResolution,
+                                       (uint32_t) kMinPWMDivider);
+    divider_ = 0;
+    pwm_range_.resize(specs.size());
+    sleep_hints_us_.resize(specs.size());
+
     // Get relevant registers
     fifo_ = s_PWM_registers + PWM_FIFO;
 
@@ -701,32 +877,66 @@ public:
     } else {
       assert(false); // should've been caught by CanHandle()
     }
-    InitPWMDivider((base/2) / PWM_BASE_TIME_NS);
-    for (size_t i = 0; i < specs.size(); ++i) {
-      pwm_range_.push_back(2 * specs[i] / base);
+    SetPulseScale(1000);
+  }
+
+  virtual void SetPulseScale(int permille) {
+    fine_ = (permille < 1000);
+    const uint32_t divider = fine_ ? fine_divider_ : coarse_divider_;
+    if (divider != divider_) {
+      WaitPulseFinished();  // Don't change the clock of a running pulse.
+      InitPWMDivider(divider);
+      divider_ = divider;
+    }
+    for (size_t i = 0; i < specs_.size(); ++i) {
+      if (!fine_) {
+        pwm_range_[i] = 2 * specs_[i] / specs_[0];
+        sleep_hints_us_[i] = specs_[i]/1000 - JitterAllowanceMicroseconds();
+        continue;
+      }
+      const int64_t scaled_ns = (int64_t)specs_[i] * permille / 1000;
+      uint32_t range = scaled_ns / (divider * PWM_BASE_TIME_NS);
+      if (range == 1) range = 2;  // Hardware can't deal with less.
+      pwm_range_[i] = range;
+      // Hints how long to nanosleep, already corrected for system overhead.
+      sleep_hints_us_[i] = scaled_ns/1000 - JitterAllowanceMicroseconds();
     }
   }
 
-  virtual void SendPulse(int c) {
-    if (pwm_range_[c] < 16) {
-      s_PWM_registers[PWM_RNG1] = pwm_range_[c];
+  virtual void SendPulse(int c) { Send(c, false); }
+
+  // Same FIFO sequence, but with 0% duty cycle periods, so it takes just as
+  // long with the output staying off.
+  virtual void SendDarkPulse(int c) { Send(c, true); }
+
+private:
+  void Send(int c, bool dark) {
+    const uint32_t range = pwm_range_[c];
+    if (range == 0) return;
+    if (range < (fine_ ? kFineSingleRangeLimit : kSingleRangeLimit)) {
+      s_PWM_registers[PWM_RNG1] = range;
 
-      *fifo_ = pwm_range_[c];
+      *fifo_ = dark ? 0 : range;
     } else {
       // Keep the actual range as short as possible, as we have to
       // wait for one full period of these in the zero phase.
       // The hardware can't deal with values < 2, so only do this when
       // have enough of these.
-      s_PWM_registers[PWM_RNG1] = pwm_range_[c] / 8;
-
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
-      *fifo_ = pwm_range_[c] / 8;
+      const uint32_t part = range / 8;
+      const uint32_t data = dark ? 0 : part;
+      s_PWM_registers[PWM_RNG1] = part;
+
+      *fifo_ = data;
+      *fifo_ = data;
+      *fifo_ = data;
+      *fifo_ = data;
+      *fifo_ = data;
+      *fifo_ = data;
+      *fifo_ = data;
+      *fifo_ = data;
+      // Scaled ranges are not multiples of 8; the remainder goes into an
+      // extra partial period, which is shorter than the others.
+      if (fine_ && range % 8) *fifo_ = dark ? 0 : range % 8;
     }
 
     /*
@@ -752,6 +962,7 @@ public:
     s_PWM_registers[PWM_CTL] = PWM_CTL_USEF1 | PWM_CTL_PWEN1 | PWM_CTL_POLA1;
   }
 
+public:
   virtual void WaitPulseFinished() {
     if (!triggered_) return;
     // Determine how long we already spent and sleep to get close to the
@@ -768,18 +979,14 @@ public:
         struct timespec sleep_time = { 0, 1000 * to_sleep_us };
         nanosleep(&sleep_time, NULL);
 
-#if DEBUG_SLEEP_JITTER
-        {
+        if (s_track_jitter.load(std::memory_order_relaxed)) {
           // Record histogram of realtime jitter how much longer we actually
           // took.
           const int total_us = *s_Timer1Mhz - start_time_;
           const int nanoslept_us = total_us - already_elapsed_usec;
-          int overshoot = nanoslept_us - (to_sleep_us + JitterAllowanceMicroseconds());
-          if (overshoot < 0) overshoot = 0;
-          if (overshoot > 255) overshoot = 255;
-          overshoot_histogram_us[overshoot]++;
+          CountJitter(s_pulse_wait_jitter, nanoslept_us
+                      - (to_sleep_us + JitterAllowanceMicroseconds()));
         }
-#endif
       }
     }
 
@@ -818,6 +1025,20 @@ private:
   }
 
 private:
+  // Clock resolution of scaled pulses in fractions of the unscaled clock.
+  static constexpr uint32_t kPulseScaleResolution = 8;
+  static constexpr uint32_t kMinPWMDivider = 4;  // 125Mhz PWM clock.
+  // Ranges below use a single period.
+  static constexpr uint32_t kSingleRangeLimit = 16;
+  // With the fine clock at least 8 * 8, so that the remainder of a split
+  // range is shorter than its parts.
+  static constexpr uint32_t kFineSingleRangeLimit = 64;
+
+  const std::vector<int> specs_;
+  uint32_t coarse_divider_;
+  uint32_t fine_divider_;
+  uint32_t divider_;    // Currently programmed divider.
+  bool fine_;           // Using fine_divider_ for scaled pulses.
   std::vector<uint32_t> pwm_range_;
   std::vector<int> sleep_hints_us_;
   volatile uint32_t *fifo_;
@@ -832,6 +1053,9 @@ private:
 PinPulser *PinPulser::Create(GPIO *io, gpio_bits_t gpio_mask,
                              bool allow_hardware_pulsing,
                              const std::vector<int> &nano_wait_spec) {
+  if (io->backend() != NULL) {
+    return new BackendPinPulser(io->backend(), gpio_mask, nano_wait_spec);
+  }
   if (!Timers::Init()) return NULL;
   if (allow_hardware_pulsing && HardwarePinPulser::CanHandle(gpio_mask)) {
     return new HardwarePinPulser(gpio_mask, nano_wait_spec);
@@ -858,4 +1082,19 @@ void SleepMicroseconds(long t) {
   Timers::sleep_nanos(t * 1000);
 }
 
+void SetSleepJitterTracking(bool enable) {
+  s_track_jitter.store(enable, std::memory_order_relaxed);
+}
+
+void GetSleepJitter(uint32_t *sleeps, uint32_t *pulse_waits) {
+  for (int i = 0; i < kSleepJitterBuckets; ++i) {
+    sleeps[i] = s_sleep_jitter[i].load(std::memory_order_relaxed);
+    pulse_waits[i] = s_pulse_wait_jitter[i].load(std::memory_order_relaxed);
+  }
+}
+
+void GetBoardTimingKey(char *key, size_t size) {
+  GetBusyWaitKey(key, size);
+}
+
 } // namespace rgb_matrix
@@ -18,6 +18,8 @@
 
 #include "gpio-bits.h"
 
+#include <stddef.h>
+
 #include <vector>
 
 #if __ARM_ARCH >= 7
@@ -29,6 +31,28 @@
 // Putting this in our namespace to not collide with other things called like
 // this.
 namespace rgb_matrix {
+// Receives the GPIO writes instead of the hardware registers, e.g. to
+// simulate a panel (see simulated-panel-internal.h).
+class GPIOBackend {
+public:
+  virtual ~GPIOBackend() {}
+
+  // Writes to the set and clear registers: bits that are '1' are set or
+  // cleared, the rest stays untouched.
+  virtual void WriteSetBits(gpio_bits_t value) = 0;
+  virtual void WriteClrBits(gpio_bits_t value) = 0;
+
+  virtual gpio_bits_t ReadBits() { return 0; }
+
+  // Pulse of the PinPulser: the (low active) "bits" are cleared for
+  // "nanos" nanoseconds. "bits" is 0 for a dark pulse, which only takes
+  // the time.
+  virtual void Pulse(gpio_bits_t bits, long nanos) = 0;
+
+  // Called by the refresh thread after each refresh of the whole frame.
+  virtual void EndOfFrame() {}
+};
+
 // For now, everything is initialized as output.
 class GPIO {
 public:
@@ -38,6 +62,19 @@ public:
   // (e.g. due to a permission problem).
   bool Init(int slowdown);
 
+  // Initialize with a backend that receives all writes instead of the
+  // hardware. Doesn't need any hardware access, so it works anywhere.
+  // The backend is not owned and has to outlive this GPIO.
+  bool Init(GPIOBackend *backend);
+
+  // The backend or NULL if writing to the hardware.
+  GPIOBackend *backend() const { return backend_; }
+
+  // Change the slowdown chosen in Init(), e.g. while tuning it (see
+  // slowdown-tuner-internal.h).
+  void SetSlowdown(int slowdown) { slowdown_ = slowdown; }
+  int slowdown() const { return slowdown_; }
+
   // Initialize outputs.
   // Returns the bits that were available and could be set for output.
   // (never use the optional adafruit_hack_needed parameter, it is used
@@ -72,8 +109,19 @@ public:
     delay();
   }
 
+  // Clear the bits in "clear", then set the bits in "set". The same as
+  // WriteMaskedBits() with both parts computed beforehand.
+  inline void WriteClearSetBits(gpio_bits_t clear, gpio_bits_t set) {
+    WriteClrBits(clear);
+    WriteSetBits(set);
+    delay();
+  }
+
   inline gpio_bits_t Read() const { return ReadRegisters() & input_bits_; }
 
+  // The bits reserved with RequestInputs().
+  gpio_bits_t input_bits() const { return input_bits_; }
+
   // Return if this is appears to be a Pi4
   static bool IsPi4();
 
@@ -85,12 +133,20 @@ private:
         return;
     }
 #endif
+    if (backend_) {
+      // Still a register write each, so that simulated timing sees them.
+      for (int n = 0; n < slowdown_; n++) {
+        backend_->WriteClrBits(0);
+      }
+      return;
+    }
     for (int n = 0; n < slowdown_; n++) {
       *gpio_clr_bits_low_ = 0;
     }
   }
 
   inline gpio_bits_t ReadRegisters() const {
+    if (backend_) return backend_->ReadBits();
     return (static_cast<gpio_bits_t>(*gpio_read_bits_low_)
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
             | (static_cast<gpio_bits_t>(*gpio_read_bits_low_) << 32)
@@ -99,6 +155,10 @@ private:
   }
 
   inline void WriteSetBits(gpio_bits_t value) {
+    if (backend_) {
+      backend_->WriteSetBits(value);
+      return;
+    }
     *gpio_set_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
     if (uses_64_bit_)
@@ -107,6 +167,10 @@ private:
   }
 
   inline void WriteClrBits(gpio_bits_t value) {
+    if (backend_) {
+      backend_->WriteClrBits(value);
+      return;
+    }
     *gpio_clr_bits_low_ = static_cast<uint32_t>(value & 0xFFFFFFFF);
 #ifdef ENABLE_WIDE_GPIO_COMPUTE_MODULE
     if (uses_64_bit_)
@@ -119,6 +183,7 @@ private:
   gpio_bits_t input_bits_;
   gpio_bits_t reserved_bits_;
   int slowdown_;
+  GPIOBackend *backend_;
 
   volatile uint32_t *gpio_set_bits_low_;
   volatile uint32_t *gpio_clr_bits_low_;
@@ -151,6 +216,14 @@ public:
   // Send a pulse with a given length (index into nano_wait_spec array).
   virtual void SendPulse(int time_spec_number) = 0;
 
+  // Take as long as SendPulse(), but leave the pins alone, e.g. to keep the
+  // timing of a row in which a bitplane is all black.
+  virtual void SendDarkPulse(int time_spec_number) = 0;
+
+  // Scale all pulses to permille/1000 of their nano_wait_spec length
+  // (0..1000). 0 suppresses pulses. Used from the next SendPulse() on.
+  virtual void SetPulseScale(int permille) = 0;
+
   // If SendPulse() is asynchronously implemented, wait for pulse to finish.
   virtual void WaitPulseFinished() {}
 };
@@ -161,6 +234,16 @@ uint32_t GetMicrosecondCounter();
 
 void SleepMicroseconds(long);
 
+// Histograms of how many microseconds the sleeps of the pulse timing
+// overshot, see RGBMatrix::SleepJitter. Counting is off by default.
+constexpr int kSleepJitterBuckets = 64;
+void SetSleepJitterTracking(bool enable);
+void GetSleepJitter(uint32_t *sleeps, uint32_t *pulse_waits);
+
+// Identifies what GPIO and busy-wait timing depend on: the board revision,
+// maximum CPU clock and governor. Used as key for timings cached on disk.
+void GetBoardTimingKey(char *key, size_t size);
+
 }  // end namespace rgb_matrix
 
 #endif  // RPI_GPIO_INGERNALH
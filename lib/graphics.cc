@@ -19,8 +19,18 @@
 #include <stdlib.h>
 #include <functional>
 #include <algorithm>
+#include <vector>
 
 namespace rgb_matrix {
+void Canvas::SetPixels(int x, int y, int width, int height, Color *colors) {
+  for (int iy = 0; iy < height; ++iy) {
+    for (int ix = 0; ix < width; ++ix) {
+      SetPixel(x + ix, y + iy, colors->r, colors->g, colors->b);
+      ++colors;
+    }
+  }
+}
+
 bool SetImage(Canvas *c, int canvas_offset_x, int canvas_offset_y,
               const uint8_t *buffer, size_t size,
               const int width, const int height,
@@ -57,21 +67,32 @@ bool SetImage(Canvas *c, int canvas_offset_x, int canvas_offset_y,
   const size_t next_row_skip = skip_start_row + skip_end_row;
   buffer += skip_start_row;
 
+  // Hand over whole rows to SetPixels(), so that canvases with a bulk
+  // conversion path can make use of it.
+  const int row_pixels = w - canvas_offset_x;
+  if (row_pixels <= 0) return true;  // Nothing left to draw in x direction.
   if (is_bgr) {
+    std::vector<Color> row(row_pixels);
     for (int y = canvas_offset_y; y < h; ++y) {
-      for (int x = canvas_offset_x; x < w; ++x) {
-        c->SetPixel(x, y, buffer[2], buffer[1], buffer[0]);
+      for (int x = 0; x < row_pixels; ++x) {
+        row[x] = Color(buffer[2], buffer[1], buffer[0]);
         buffer += 3;
       }
+      c->SetPixels(canvas_offset_x, y, row_pixels, 1, row.data());
       buffer += next_row_skip;
     }
   } else {
-    for (int y = canvas_offset_y; y < h; ++y) {
-      for (int x = canvas_offset_x; x < w; ++x) {
-        c->SetPixel(x, y, buffer[0], buffer[1], buffer[2]);
-        buffer += 3;
+    // Color is just three bytes r, g, b, so the buffer can be passed as-is.
+    static_assert(sizeof(Color) == 3, "Color expected to be packed rgb");
+    Color *pixels = reinterpret_cast<Color*>(const_cast<uint8_t*>(buffer));
+    if (next_row_skip == 0) {
+      c->SetPixels(canvas_offset_x, canvas_offset_y,
+                   row_pixels, h - canvas_offset_y, pixels);
+    } else {
+      for (int y = canvas_offset_y; y < h; ++y) {
+        c->SetPixels(canvas_offset_x, y, row_pixels, 1, pixels);
+        pixels += row_pixels + next_row_skip / 3;
       }
-      buffer += next_row_skip;
     }
   }
   return true;
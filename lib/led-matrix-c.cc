@@ -89,6 +89,10 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     OPT_COPY_IF_SET(panel_type);
     OPT_COPY_IF_SET(limit_refresh_rate_hz);
     OPT_COPY_IF_SET(disable_busy_waiting);
+    OPT_COPY_IF_SET(conversion_threads);
+    OPT_COPY_IF_SET(min_refresh_rate_hz);
+    OPT_COPY_IF_SET(split_bitplanes);
+    OPT_COPY_IF_SET(compile_output);
 #undef OPT_COPY_IF_SET
   }
 
@@ -101,6 +105,8 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     RT_OPT_COPY_IF_SET(do_gpio_init);
     RT_OPT_COPY_IF_SET(drop_priv_user);
     RT_OPT_COPY_IF_SET(drop_priv_group);
+    RT_OPT_COPY_IF_SET(max_panel_clock_khz);
+    RT_OPT_COPY_IF_SET(output_backend);
 #undef RT_OPT_COPY_IF_SET
   }
 
@@ -136,6 +142,10 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     ACTUAL_VALUE_BACK_TO_OPT(panel_type);
     ACTUAL_VALUE_BACK_TO_OPT(limit_refresh_rate_hz);
     ACTUAL_VALUE_BACK_TO_OPT(disable_busy_waiting);
+    ACTUAL_VALUE_BACK_TO_OPT(conversion_threads);
+    ACTUAL_VALUE_BACK_TO_OPT(min_refresh_rate_hz);
+    ACTUAL_VALUE_BACK_TO_OPT(split_bitplanes);
+    ACTUAL_VALUE_BACK_TO_OPT(compile_output);
 #undef ACTUAL_VALUE_BACK_TO_OPT
   }
 
@@ -147,6 +157,8 @@ static struct RGBLedMatrix *led_matrix_create_from_options_optional_edit(
     ACTUAL_VALUE_BACK_TO_RT_OPT(do_gpio_init);
     ACTUAL_VALUE_BACK_TO_RT_OPT(drop_priv_user);
     ACTUAL_VALUE_BACK_TO_RT_OPT(drop_priv_group);
+    ACTUAL_VALUE_BACK_TO_RT_OPT(max_panel_clock_khz);
+    ACTUAL_VALUE_BACK_TO_RT_OPT(output_backend);
 #undef ACTUAL_VALUE_BACK_TO_RT_OPT
   }
 
@@ -202,11 +214,88 @@ struct LedCanvas *led_matrix_create_offscreen_canvas(struct RGBLedMatrix *m) {
   return from_canvas(to_matrix(m)->CreateFrameCanvas());
 }
 
+int led_matrix_release_offscreen_canvas(struct RGBLedMatrix *matrix,
+                                        struct LedCanvas *canvas) {
+  return to_matrix(matrix)->ReleaseFrameCanvas(to_canvas(canvas));
+}
+
 struct LedCanvas *led_matrix_swap_on_vsync(struct RGBLedMatrix *matrix,
                                            struct LedCanvas *canvas) {
   return from_canvas(to_matrix(matrix)->SwapOnVSync(to_canvas(canvas)));
 }
 
+struct LedCanvas *led_matrix_publish_canvas(struct RGBLedMatrix *matrix,
+                                            struct LedCanvas *canvas) {
+  return from_canvas(to_matrix(matrix)->PublishFrameCanvas(to_canvas(canvas)));
+}
+
+struct LedCanvas *led_matrix_present_canvas(struct RGBLedMatrix *matrix,
+                                            struct LedCanvas *canvas,
+                                            uint64_t present_at_us) {
+  return from_canvas(to_matrix(matrix)->PresentFrameCanvas(to_canvas(canvas),
+                                                           present_at_us));
+}
+
+uint64_t led_matrix_monotonic_micros(void) {
+  return rgb_matrix::RGBMatrix::MonotonicMicros();
+}
+
+int led_matrix_get_refresh_stats(struct RGBLedMatrix *matrix,
+                                 struct LedRefreshStats *stats) {
+  rgb_matrix::RGBMatrix::RefreshStats s;
+  if (!to_matrix(matrix)->GetRefreshStats(&s)) return 0;
+  stats->refreshes = s.refreshes;
+  stats->min_refresh_usec = s.min_refresh_usec;
+  stats->max_refresh_usec = s.max_refresh_usec;
+  stats->mean_refresh_usec = s.mean_refresh_usec;
+  stats->p50_refresh_usec = s.p50_refresh_usec;
+  stats->p90_refresh_usec = s.p90_refresh_usec;
+  stats->p99_refresh_usec = s.p99_refresh_usec;
+  stats->swaps = s.swaps;
+  stats->mean_swap_latency_usec = s.mean_swap_latency_usec;
+  stats->p99_swap_latency_usec = s.p99_swap_latency_usec;
+  stats->max_swap_latency_usec = s.max_swap_latency_usec;
+  stats->missed_deadlines = s.missed_deadlines;
+  stats->late_frames = s.late_frames;
+  stats->dropped_frames = s.dropped_frames;
+  stats->bitplanes = s.bitplanes;
+  stats->blank_bitplanes = s.blank_bitplanes;
+  stats->skipped_clock_outs = s.skipped_clock_outs;
+  return 1;
+}
+
+void led_matrix_get_refresh_config(struct RGBLedMatrix *matrix,
+                                   int *pwm_bits, int *pwm_dither_bits,
+                                   int *pwm_lsb_nanoseconds) {
+  rgb_matrix::RGBMatrix::RefreshConfig config;
+  to_matrix(matrix)->GetRefreshConfig(&config);
+  *pwm_bits = config.pwm_bits;
+  *pwm_dither_bits = config.pwm_dither_bits;
+  *pwm_lsb_nanoseconds = config.pwm_lsb_nanoseconds;
+}
+
+void led_matrix_set_refresh_profiling(struct RGBLedMatrix *matrix, int enable) {
+  to_matrix(matrix)->SetRefreshProfiling(enable != 0);
+}
+
+int led_matrix_write_refresh_profile(struct RGBLedMatrix *matrix, FILE *out) {
+  return to_matrix(matrix)->WriteRefreshProfile(out);
+}
+
+static_assert(sizeof(rgb_matrix::RGBMatrix::SleepJitter) == sizeof(LedSleepJitter), "C and C++ out of sync");
+
+void led_matrix_set_sleep_jitter_tracking(struct RGBLedMatrix *matrix,
+                                          int enable) {
+  to_matrix(matrix)->SetSleepJitterTracking(enable != 0);
+}
+
+void led_matrix_get_sleep_jitter(struct RGBLedMatrix *matrix,
+                                 struct LedSleepJitter *jitter) {
+  rgb_matrix::RGBMatrix::SleepJitter j;
+  to_matrix(matrix)->GetSleepJitter(&j);
+  memcpy(jitter, &j, sizeof(*jitter));
+}
+
 void led_matrix_set_brightness(struct RGBLedMatrix *matrix,
                                uint8_t brightness) {
   to_matrix(matrix)->SetBrightness(brightness);
@@ -216,6 +305,15 @@ uint8_t led_matrix_get_brightness(struct RGBLedMatrix *matrix) {
   return to_matrix(matrix)->brightness();
 }
 
+void led_matrix_set_display_brightness(struct RGBLedMatrix *matrix,
+                                       uint8_t percent, int fade_ms) {
+  to_matrix(matrix)->SetDisplayBrightness(percent, fade_ms);
+}
+
+uint8_t led_matrix_get_display_brightness(struct RGBLedMatrix *matrix) {
+  return to_matrix(matrix)->display_brightness();
+}
+
 void led_canvas_get_size(const struct LedCanvas *canvas,
                          int *width, int *height) {
   rgb_matrix::FrameCanvas *c = to_canvas((struct LedCanvas*)canvas);
@@ -242,6 +340,23 @@ void led_canvas_fill(struct LedCanvas *canvas, uint8_t r, uint8_t g, uint8_t b)
   to_canvas(canvas)->Fill(r, g, b);
 }
 
+void led_canvas_set_rgb_back_buffer(struct LedCanvas *canvas, int enable) {
+  to_canvas(canvas)->SetRGBBackBuffer(enable != 0);
+}
+
+void led_canvas_commit(struct LedCanvas *canvas) {
+  to_canvas(canvas)->Commit();
+}
+
+int led_canvas_get_pixel(const struct LedCanvas *canvas, int x, int y,
+                         uint8_t *r, uint8_t *g, uint8_t *b) {
+  return to_canvas((struct LedCanvas*)canvas)->GetPixel(x, y, r, g, b);
+}
+
+void led_canvas_set_compact_storage(struct LedCanvas *canvas, int enable) {
+  to_canvas(canvas)->SetCompactStorage(enable != 0);
+}
+
 struct LedFont *load_font(const char *bdf_font_file) {
   rgb_matrix::Font* font = new rgb_matrix::Font();
   font->LoadFont(bdf_font_file);
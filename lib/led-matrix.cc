@@ -24,15 +24,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+
 #include "gpio.h"
 #include "thread.h"
 #include "framebuffer-internal.h"
 #include "multiplex-mappers-internal.h"
+#include "output-backend-internal.h"
+#include "refresh-governor-internal.h"
+#include "refresh-profiler-internal.h"
+#include "refresh-stats-internal.h"
+#include "slowdown-tuner-internal.h"
+#include "worker-pool-internal.h"
 
 // Leave this in here for a while. Setting things from old defines.
 #if defined(ADAFRUIT_RGBMATRIX_HAT)
@@ -44,9 +56,16 @@
 #endif
 
 namespace rgb_matrix {
+// The refresh thread is pinned to this CPU; see StartRefresh().
+static constexpr int kRefreshCpu = 3;
+
+// Released FrameCanvases kept for re-use by CreateFrameCanvas().
+static constexpr size_t kMaxFreeFrameCanvases = 8;
+
 // Implementation details of RGBmatrix.
 class RGBMatrix::Impl {
   class UpdateThread;
+  class RefreshPrinter;
   friend class UpdateThread;
 
 public:
@@ -73,7 +92,14 @@ public:
   bool StartRefresh();
 
   FrameCanvas *CreateFrameCanvas();
+  bool ReleaseFrameCanvas(FrameCanvas *canvas);
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned framerate_fraction);
+  FrameCanvas *PublishFrameCanvas(FrameCanvas *frame);
+  FrameCanvas *PresentFrameCanvas(FrameCanvas *frame, uint64_t present_at_us);
+  bool GetRefreshStats(RefreshStats *stats) const;
+  void SetRefreshProfiling(bool enable);
+  int WriteRefreshProfile(FILE *out) const;
+  void GetRefreshConfig(RefreshConfig *config) const;
   bool ApplyPixelMapper(const PixelMapper *mapper);
 
   bool SetPWMBits(uint8_t value);
@@ -87,8 +113,14 @@ public:
   void SetBrightness(uint8_t brightness);
   uint8_t brightness();
 
+  void SetDisplayBrightness(uint8_t percent, int fade_ms);
+  uint8_t display_brightness() const { return display_brightness_; }
+
   uint64_t RequestInputs(uint64_t);
   uint64_t AwaitInputChange(int timeout_ms);
+  void SetInputDebounce(uint64_t bits, uint32_t debounce_us);
+  int ReadInputEvents(InputEvent *events, int max_events, int timeout_ms);
+  int InputEventFd() const;
 
   uint64_t RequestOutputs(uint64_t output_bits);
   void OutputGPIO(uint64_t output_bits);
@@ -101,34 +133,105 @@ private:
   void ApplyNamedPixelMappers(const char *pixel_mapper_config,
                               int chain, int parallel);
 
+  // Get "frame" ready to be handed to the refresh thread.
+  void PrepareForRefresh(FrameCanvas *frame);
+
   Options params_;
   bool do_luminance_correct_;
+  uint8_t display_brightness_;  // Target of the last SetDisplayBrightness()
 
   FrameCanvas *active_;
 
   GPIO *io_;
   Mutex active_frame_sync_;
   UpdateThread *updater_;
+  RefreshPrinter *refresh_printer_;  // Only with show_refresh_rate.
+  // Created on first SetRefreshProfiling(true). Kept until the end, as the
+  // refresh thread might still be using it after profiling is switched off.
+  internal::RefreshProfiler *profiler_;
+  internal::RefreshGovernor *governor_;  // Only with min_refresh_rate_hz.
   std::vector<FrameCanvas*> created_frames_;
+  std::vector<FrameCanvas*> free_frames_;  // Released, ready for re-use.
   internal::PixelDesignatorMap *shared_pixel_mapper_;
   uint64_t user_output_bits_;
+  internal::WorkerPool *conversion_pool_;
 };
 
 using namespace internal;
 
+namespace {
+// Bounded queue between exactly one producer and one consumer thread,
+// without locks.
+template <typename T, unsigned kSize>
+class SingleProducerQueue {
+public:
+  SingleProducerQueue() : head_(0), tail_(0) {}
+
+  // Producer side.
+  bool full() const {
+    return head_.load(std::memory_order_relaxed)
+      - tail_.load(std::memory_order_acquire) == kSize;
+  }
+  bool Push(const T &item) {
+    if (full()) return false;
+    const unsigned head = head_.load(std::memory_order_relaxed);
+    items_[head % kSize] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Front() is only valid if !empty().
+  bool empty() const {
+    return head_.load(std::memory_order_acquire)
+      == tail_.load(std::memory_order_relaxed);
+  }
+  const T &Front() const {
+    return items_[tail_.load(std::memory_order_relaxed) % kSize];
+  }
+  void Pop() {
+    tail_.fetch_add(1, std::memory_order_release);
+  }
+
+  // Snapshot of the queued items; only exact while neither side is busy.
+  template <typename Predicate> bool Any(Predicate p) const {
+    const unsigned head = head_.load(std::memory_order_acquire);
+    for (unsigned i = tail_.load(std::memory_order_acquire); i != head; ++i) {
+      if (p(items_[i % kSize])) return true;
+    }
+    return false;
+  }
+
+private:
+  T items_[kSize];
+  std::atomic<unsigned> head_;  // Next to write.
+  std::atomic<unsigned> tail_;  // Next to read.
+};
+}  // namespace
+
 // Pump pixels to screen. Needs to be high priority real-time because jitter
 class RGBMatrix::Impl::UpdateThread : public Thread {
 public:
   UpdateThread(GPIO *io, FrameCanvas *initial_frame,
-               int pwm_dither_bits, bool show_refresh,
-               int limit_refresh_hz, bool allow_busy_waiting)
-    : io_(io), show_refresh_(show_refresh),
+               int pwm_dither_bits,
+               int limit_refresh_hz, bool allow_busy_waiting,
+               RefreshGovernor *governor)
+    : io_(io),
       target_frame_usec_(limit_refresh_hz < 1 ? 0 : 1e6/limit_refresh_hz),
-      allow_busy_waiting_(allow_busy_waiting),
+      allow_busy_waiting_(allow_busy_waiting), governor_(governor),
       running_(true),
+      input_event_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      input_state_(0), dropped_input_events_(0),
       current_frame_(initial_frame), next_frame_(NULL),
-      requested_frame_multiple_(1) {
+      requested_frame_multiple_(1), vsync_waiters_(0),
+      published_(0), present_waiters_(0), fade_generation_(0) {
+    for (int i = 0; i < kInputPins; ++i) {
+      input_change_us_[i] = 0;
+      debounce_us_[i].store(0, std::memory_order_relaxed);
+    }
+    fade_.from = fade_.to = 1000;
+    fade_.start_us = fade_.usec = 0;
     pthread_cond_init(&frame_done_, NULL);
+    pthread_cond_init(&present_space_, NULL);
     pthread_cond_init(&input_change_, NULL);
     switch (pwm_dither_bits) {
     case 0:
@@ -146,31 +249,102 @@ public:
     }
   }
 
+  virtual ~UpdateThread() {
+    if (input_event_fd_ >= 0) close(input_event_fd_);
+  }
+
   void Stop() {
-    MutexLock l(&running_mutex_);
-    running_ = false;
+    running_.store(false);
   }
 
   virtual void Run() {
     unsigned frame_count = 0;
     unsigned low_bit_sequence = 0;
-    uint32_t largest_time = 0;
-    gpio_bits_t last_gpio_bits = 0;
-
-    // Let's start measure max time only after a we were running for a few
-    // seconds to not pick up start-up glitches.
-    static const int kHoldffTimeUs = 2000 * 1000;
-    uint32_t initial_holdoff_start = GetMicrosecondCounter();
-    bool max_measure_enabled = false;
+    uint32_t last_refresh_us = 0;
+
+    OutputFade fade;
+    unsigned fade_generation;
+    {
+      MutexLock l(&frame_sync_);
+      fade = fade_;
+      fade_generation = fade_generation_.load();
+    }
+    int output_scale = -1;
 
-    while (running()) {
+    while (running_.load(std::memory_order_relaxed)) {
       const uint32_t start_time_us = GetMicrosecondCounter();
 
-      current_frame_->framebuffer()
-        ->DumpToMatrix(io_, start_bit_[low_bit_sequence % 4]);
+      // Display brightness. Only lock when there was a change.
+      if (fade_generation_.load(std::memory_order_acquire) != fade_generation) {
+        MutexLock l(&frame_sync_);
+        fade = fade_;
+        fade_generation = fade_generation_.load();
+      }
+      int scale = fade.At(start_time_us);
+      int low_bit = start_bit_[low_bit_sequence % 4];
+      if (governor_) {
+        const RefreshGovernor::Level &level = governor_->level();
+        scale = scale * level.pulse_permille / 1000;
+        low_bit = std::max(low_bit, Framebuffer::kBitPlanes - level.pwm_bits);
+      }
+      if (scale != output_scale) {
+        Framebuffer::SetOutputScale(scale);
+        output_scale = scale;
+      }
+
+      // PublishFrameCanvas() exchange: take the newest published frame and
+      // leave the previous one in the slot for the producer to re-use.
+      if (published_.load(std::memory_order_relaxed) & kFreshFrame) {
+        const uintptr_t fresh = published_.exchange(
+          (uintptr_t)current_frame_.load(std::memory_order_relaxed),
+          std::memory_order_acq_rel);
+        FrameCanvas *const frame = (FrameCanvas*)(fresh & ~kFreshFrame);
+        current_frame_.store(frame, std::memory_order_relaxed);
+        // The exchange made the publish time of this frame visible and the
+        // clock is read after it. Clamp anyway, so that a wrapped
+        // difference never shows up as a huge latency.
+        const int32_t latency_us = (int32_t)(GetMicrosecondCounter()
+                                 - frame->framebuffer()->publish_time_us());
+        stats_.RecordSwap(latency_us > 0 ? latency_us : 0);
+      }
+
+      // Switch to the newest frame in the presentation queue that is due.
+      if (!present_queue_.empty()) {
+        const uint64_t now_us = MonotonicMicros();
+        bool presented = false;
+        uint64_t present_at_us = 0;
+        while (!present_queue_.empty()
+               && present_queue_.Front().present_at_us <= now_us) {
+          if (presented) stats_.RecordDroppedFrame();  // Never shown.
+          // Hand back first, so that there is a free frame whenever
+          // there is space in the queue.
+          free_frames_.Push(current_frame_.load(std::memory_order_relaxed));
+          current_frame_.store(present_queue_.Front().frame,
+                               std::memory_order_relaxed);
+          present_at_us = present_queue_.Front().present_at_us;
+          present_queue_.Pop();
+          presented = true;
+        }
+        if (presented) {
+          const uint32_t late_us = now_us - present_at_us;
+          stats_.RecordSwap(late_us);
+          // Should have been shown with the previous refresh already.
+          if (late_us > last_refresh_us) stats_.RecordLateFrame();
+          if (present_waiters_.load(std::memory_order_acquire)) {
+            MutexLock l(&frame_sync_);
+            pthread_cond_signal(&present_space_);
+          }
+        }
+      }
+
+      Framebuffer::OutputCounts counts;
+      current_frame_.load(std::memory_order_relaxed)->framebuffer()
+        ->DumpToMatrix(io_, low_bit, &counts);
+      stats_.RecordBitplanes(counts);
+      if (io_->backend()) io_->backend()->EndOfFrame();
 
-      // SwapOnVSync() exchange.
-      {
+      // SwapOnVSync() exchange. Only needs the lock if someone is waiting.
+      if (vsync_waiters_.load(std::memory_order_acquire) > 0) {
         MutexLock l(&frame_sync_);
         // Do fast equality test first (likely due to frame_count reset).
         if (frame_count == requested_frame_multiple_
@@ -179,29 +353,36 @@ public:
           // run-time iff requested_frame_multiple_ is not a factor of 2^32.
           frame_count = 0;
           if (next_frame_ != NULL) {
-            current_frame_ = next_frame_;
+            current_frame_.store(next_frame_);
             next_frame_ = NULL;
+            stats_.RecordSwap(GetMicrosecondCounter() - swap_request_us_);
           }
           pthread_cond_signal(&frame_done_);
         }
       }
 
-      // Read input bits.
-      const gpio_bits_t inputs = io_->Read();
-      if (inputs != last_gpio_bits) {
-        last_gpio_bits = inputs;
-        MutexLock l(&input_sync_);
-        gpio_inputs_ = inputs;
-        pthread_cond_signal(&input_change_);
-      }
+      SampleInputs();
 
       ++frame_count;
       ++low_bit_sequence;
 
       if (target_frame_usec_) {
+        if (GetMicrosecondCounter() - start_time_us > target_frame_usec_) {
+          stats_.RecordMissedDeadline();
+        }
         if (allow_busy_waiting_) {
           while ((GetMicrosecondCounter() - start_time_us) < target_frame_usec_) {
             // busy wait. We have our dedicated core, so ok to burn cycles.
+            SampleInputs();
+          }
+        } else if (io_->input_bits()) {
+          // Don't leave inputs unseen for the whole wait.
+          long remaining_us;
+          while ((remaining_us = (long)target_frame_usec_
+                  - (long)(GetMicrosecondCounter() - start_time_us)) > 0) {
+            SleepMicroseconds(remaining_us < kInputPollUsec
+                              ? remaining_us : kInputPollUsec);
+            SampleInputs();
           }
         } else {
           long spent_us = GetMicrosecondCounter() - start_time_us;
@@ -209,62 +390,280 @@ public:
         }
       }
 
-      const uint32_t end_time_us = GetMicrosecondCounter();
-      if (show_refresh_) {
-        uint32_t usec = end_time_us - start_time_us;
-        printf("\b\b\b\b\b\b\b\b%6.1fHz", 1e6 / usec);
-        if (usec > largest_time && max_measure_enabled) {
-          largest_time = usec;
-          const float lowest_hz = 1e6 / largest_time;
-          printf(" (lowest: %.1fHz)"
-                 "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b", lowest_hz);
-        } else {
-          // Don't measure at startup, as times will be janky.
-          max_measure_enabled = (end_time_us - initial_holdoff_start) > kHoldffTimeUs;
-        }
-      }
+      last_refresh_us = GetMicrosecondCounter() - start_time_us;
+      stats_.RecordRefresh(last_refresh_us);
+      if (governor_) governor_->Update(start_time_us + last_refresh_us);
     }
   }
 
   FrameCanvas *SwapOnVSync(FrameCanvas *other, unsigned frame_fraction) {
     MutexLock l(&frame_sync_);
-    FrameCanvas *previous = current_frame_;
+    FrameCanvas *previous = current_frame_.load();
     next_frame_ = other;
     requested_frame_multiple_ = frame_fraction;
+    swap_request_us_ = GetMicrosecondCounter();
+    vsync_waiters_.fetch_add(1);
     frame_sync_.WaitOn(&frame_done_);
+    vsync_waiters_.fetch_sub(1);
     return previous;
   }
 
+  // Hand "frame" to the refresh thread, which shows it from its next
+  // refresh on, unless a newer frame is published before. Returns the
+  // frame that is free now: the one replaced on the screen or a dropped
+  // one that was never shown. NULL on the first call.
+  FrameCanvas *Publish(FrameCanvas *frame) {
+    frame->framebuffer()->set_publish_time_us(GetMicrosecondCounter());
+    const uintptr_t previous = published_.exchange(
+      (uintptr_t)frame | kFreshFrame, std::memory_order_acq_rel);
+    if (previous & kFreshFrame) stats_.RecordDroppedFrame();
+    return (FrameCanvas*)(previous & ~kFreshFrame);
+  }
+
+  // Queue the frame to be shown at present_at_us. Blocks while the
+  // queue is full. Returns a frame that is not needed anymore, or NULL if
+  // there is none yet.
+  FrameCanvas *Present(FrameCanvas *frame, uint64_t present_at_us) {
+    if (present_queue_.full()) {
+      MutexLock l(&frame_sync_);
+      present_waiters_.fetch_add(1);
+      while (present_queue_.full())
+        frame_sync_.WaitOn(&present_space_, kPresentPollMs);
+      present_waiters_.fetch_sub(1);
+    }
+    const PresentEntry entry = { frame, present_at_us };
+    present_queue_.Push(entry);
+    if (free_frames_.empty()) return NULL;
+    FrameCanvas *const result = free_frames_.Front();
+    free_frames_.Pop();
+    return result;
+  }
+
+  void GetStats(RefreshStats *stats) const { stats_.Get(stats); }
+
+  // Change the output scale (permille) in a linear ramp over fade_ms,
+  // starting from where we are now.
+  void FadeOutputScale(int permille, int fade_ms) {
+    MutexLock l(&frame_sync_);
+    const uint32_t now_us = GetMicrosecondCounter();
+    fade_.from = fade_.At(now_us);
+    fade_.to = permille;
+    fade_.start_us = now_us;
+    fade_.usec = fade_ms > 0 ? fade_ms * 1000 : 0;
+    fade_generation_.fetch_add(1, std::memory_order_release);
+  }
+
+  // If the frame is shown, about to be shown or waiting in the exchange
+  // slot of PublishFrameCanvas().
+  bool IsShowing(const FrameCanvas *frame) {
+    MutexLock l(&frame_sync_);
+    struct IsFrame {
+      const FrameCanvas *f;
+      bool operator()(const PresentEntry &e) const { return e.frame == f; }
+      bool operator()(FrameCanvas *c) const { return c == f; }
+    } is_frame = { frame };
+    return frame == current_frame_.load() || frame == next_frame_
+      || frame == (FrameCanvas*)(published_.load() & ~kFreshFrame)
+      || present_queue_.Any(is_frame) || free_frames_.Any(is_frame);
+  }
+
   gpio_bits_t AwaitInputChange(int timeout_ms) {
     MutexLock l(&input_sync_);
     input_sync_.WaitOn(&input_change_, timeout_ms);
     return gpio_inputs_;
   }
 
-private:
-  inline bool running() {
-    MutexLock l(&running_mutex_);
-    return running_;
+  void SetInputDebounce(uint64_t bits, uint32_t debounce_us) {
+    for (int i = 0; i < kInputPins; ++i) {
+      if (bits & (1ULL << i))
+        debounce_us_[i].store(debounce_us, std::memory_order_relaxed);
+    }
+  }
+
+  int ReadInputEvents(InputEvent *events, int max_events, int timeout_ms) {
+    int count = PopInputEvents(events, max_events);
+    if (count == 0 && timeout_ms != 0 && input_event_fd_ >= 0) {
+      struct pollfd p = { input_event_fd_, POLLIN, 0 };
+      if (poll(&p, 1, timeout_ms) > 0)
+        count = PopInputEvents(events, max_events);
+    }
+    return count;
   }
 
+  int input_event_fd() const { return input_event_fd_; }
+
+private:
+  // Set in published_ for a frame that is not picked up yet.
+  static constexpr uintptr_t kFreshFrame = 1;
+
+  static constexpr int kInputPins = sizeof(gpio_bits_t) * 8;
+  // While waiting for the next refresh, inputs are sampled that often.
+  static constexpr long kInputPollUsec = 1000;
+
+  // Frames that can be queued for presentation; producers block beyond.
+  static constexpr unsigned kPresentQueueSize = 8;
+  // Producers re-check a full queue at least that often (a signal from the
+  // refresh thread is missed if the queue drains while they go to sleep).
+  static constexpr int kPresentPollMs = 10;
+
+  struct PresentEntry {
+    FrameCanvas *frame;
+    uint64_t present_at_us;
+  };
+
+  // Display brightness ramp, in permille of the full pulse length.
+  struct OutputFade {
+    int from;
+    int to;
+    uint32_t start_us;
+    uint32_t usec;
+
+    int At(uint32_t now_us) const {
+      const uint32_t elapsed_us = now_us - start_us;
+      if (elapsed_us >= usec) return to;
+      return from + (int64_t)(to - from) * elapsed_us / usec;
+    }
+  };
+
   GPIO *const io_;
-  const bool show_refresh_;
   const uint32_t target_frame_usec_;
   const bool allow_busy_waiting_;
+  RefreshGovernor *const governor_;  // Not owned; NULL if not governed.
   uint32_t start_bit_[4];
 
-  Mutex running_mutex_;
-  bool running_;
+  std::atomic<bool> running_;
+
+  // Reads the inputs and queues an event for each change that is not
+  // suppressed by debouncing. Called from the refresh thread only.
+  void SampleInputs() {
+    const gpio_bits_t differ = io_->Read() ^ input_state_;
+    if (!differ) return;
+    const uint64_t now_us = MonotonicMicros();
+    gpio_bits_t changed = 0;
+    for (int i = 0; i < kInputPins; ++i) {
+      const gpio_bits_t bit = (gpio_bits_t)1 << i;
+      if ((differ & bit) == 0) continue;
+      if (now_us - input_change_us_[i]
+          < debounce_us_[i].load(std::memory_order_relaxed)) {
+        continue;  // Still bouncing from the previous change.
+      }
+      input_change_us_[i] = now_us;
+      changed |= bit;
+    }
+    if (!changed) return;
+    input_state_ ^= changed;
+
+    const InputEvent event = { now_us, input_state_, changed,
+                               dropped_input_events_ };
+    if (input_events_.Push(event)) {
+      dropped_input_events_ = 0;
+      const uint64_t one = 1;
+      if (input_event_fd_ >= 0)
+        (void) write(input_event_fd_, &one, sizeof(one));  // Just a wakeup.
+    } else {
+      ++dropped_input_events_;
+    }
+
+    MutexLock l(&input_sync_);
+    gpio_inputs_ = input_state_;
+    pthread_cond_signal(&input_change_);
+  }
+
+  int PopInputEvents(InputEvent *events, int max_events) {
+    MutexLock l(&input_sync_);
+    // Reset first: events queued from now on make it readable again.
+    uint64_t pending;
+    if (input_event_fd_ >= 0)
+      (void) read(input_event_fd_, &pending, sizeof(pending));
+    int count = 0;
+    while (count < max_events && !input_events_.empty()) {
+      events[count++] = input_events_.Front();
+      input_events_.Pop();
+    }
+    // More than "max_events" queued: keep the fd readable for the rest.
+    if (!input_events_.empty() && input_event_fd_ >= 0) {
+      const uint64_t one = 1;
+      (void) write(input_event_fd_, &one, sizeof(one));
+    }
+    return count;
+  }
 
   Mutex input_sync_;
   pthread_cond_t input_change_;
   gpio_bits_t gpio_inputs_;
 
+  // Input events, see SampleInputs(). Consumers are serialized by
+  // input_sync_.
+  SingleProducerQueue<InputEvent, kInputEventQueueSize> input_events_;
+  const int input_event_fd_;      // eventfd() signalling input_events_.
+  gpio_bits_t input_state_;       // Debounced state of the inputs.
+  uint64_t input_change_us_[kInputPins];
+  std::atomic<uint32_t> debounce_us_[kInputPins];
+  uint32_t dropped_input_events_;
+
   Mutex frame_sync_;
   pthread_cond_t frame_done_;
-  FrameCanvas *current_frame_;
+  std::atomic<FrameCanvas*> current_frame_;  // Only changed by our thread.
   FrameCanvas *next_frame_;
   unsigned requested_frame_multiple_;
+  uint32_t swap_request_us_;
+  std::atomic<int> vsync_waiters_;  // Threads waiting in SwapOnVSync().
+
+  // Triple buffering slot; see Publish().
+  std::atomic<uintptr_t> published_;
+
+  // Presentation queue, see Present(). Frames replaced on the screen go
+  // back to the producer through free_frames_. There can't be more of
+  // these than frames in the queue, plus the one shown before.
+  SingleProducerQueue<PresentEntry, kPresentQueueSize> present_queue_;
+  SingleProducerQueue<FrameCanvas*, kPresentQueueSize + 2> free_frames_;
+  pthread_cond_t present_space_;
+  std::atomic<int> present_waiters_;  // Threads waiting in Present().
+
+  OutputFade fade_;                        // Guarded by frame_sync_
+  std::atomic<unsigned> fade_generation_;  // Incremented on change.
+
+  RefreshStatsRecorder stats_;
+};
+
+// Prints the refresh rate for Options::show_refresh_rate, outside the
+// refresh thread.
+class RGBMatrix::Impl::RefreshPrinter : public Thread {
+public:
+  RefreshPrinter(const UpdateThread *updater)
+    : updater_(updater), running_(true) {}
+
+  void Stop() { running_.store(false); }
+
+  virtual void Run() {
+    RefreshStats last;
+    updater_->GetStats(&last);
+    uint32_t last_time_us = GetMicrosecondCounter();
+    while (running_.load()) {
+      SleepMicroseconds(kPrintIntervalUsec);
+      RefreshStats now;
+      updater_->GetStats(&now);
+      const uint32_t now_us = GetMicrosecondCounter();
+      if (now.refreshes == last.refreshes) continue;
+      const float hz = 1e6 * (now.refreshes - last.refreshes)
+        / (now_us - last_time_us);
+      printf("\b\b\b\b\b\b\b\b%6.1fHz", hz);
+      if (now.max_refresh_usec > 0) {
+        const float lowest_hz = 1e6 / now.max_refresh_usec;
+        printf(" (lowest: %.1fHz)"
+               "\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b\b", lowest_hz);
+      }
+      fflush(stdout);
+      last = now;
+      last_time_us = now_us;
+    }
+  }
+
+private:
+  static constexpr long kPrintIntervalUsec = 100 * 1000;
+
+  const UpdateThread *const updater_;
+  std::atomic<bool> running_;
 };
 
 // Some defaults. See options-initialize.cc for the command line parsing.
@@ -326,10 +725,14 @@ RGBMatrix::Options::Options() :
   limit_refresh_rate_hz(0),
 #endif
 #ifdef DISABLE_BUSY_WAITING
-    disable_busy_waiting(true)
+    disable_busy_waiting(true),
 #else
-    disable_busy_waiting(false)
+    disable_busy_waiting(false),
 #endif
+  conversion_threads(0),
+  min_refresh_rate_hz(0),
+  split_bitplanes(false),
+  compile_output(false)
 {
   // Nothing to see here.
 }
@@ -361,6 +764,10 @@ static void PrintOptions(const RGBMatrix::Options &o) {
   P_STR(panel_type);
   P_INT(limit_refresh_rate_hz);
   P_BOOL(disable_busy_waiting);
+  P_INT(conversion_threads);
+  P_INT(min_refresh_rate_hz);
+  P_BOOL(split_bitplanes);
+  P_BOOL(compile_output);
 #undef P_INT
 #undef P_STR
 #undef P_BOOL
@@ -368,8 +775,11 @@ static void PrintOptions(const RGBMatrix::Options &o) {
 #endif  // DEBUG_MATRIX_OPTIONS
 
 RGBMatrix::Impl::Impl(GPIO *io, const Options &options)
-  : params_(options), io_(NULL), updater_(NULL), shared_pixel_mapper_(NULL),
-    user_output_bits_(0) {
+  : params_(options), display_brightness_(100),
+    io_(NULL), updater_(NULL), refresh_printer_(NULL), profiler_(NULL),
+    governor_(NULL),
+    shared_pixel_mapper_(NULL),
+    user_output_bits_(0), conversion_pool_(NULL) {
   assert(params_.Validate(NULL));
 #if DEBUG_MATRIX_OPTIONS
   PrintOptions(params_);
@@ -401,14 +811,41 @@ RGBMatrix::Impl::Impl(GPIO *io, const Options &options)
   // .. followed by higher level mappers that might arrange panels.
   ApplyNamedPixelMappers(options.pixel_mapper_config,
                          params_.chain_length, params_.parallel);
+
+  // Conversion helpers stay off the refresh core, so there is at most one
+  // per remaining core.
+  const uint32_t helper_cpus
+    = internal::WorkerPool::AffinityExcludingCore(kRefreshCpu);
+  const int helpers = std::min(params_.conversion_threads,
+                               __builtin_popcount(helper_cpus));
+  if (helpers > 0) {
+    conversion_pool_ = new internal::WorkerPool(helpers, helper_cpus);
+    Framebuffer::SetConversionPool(conversion_pool_);
+  }
 }
 
 RGBMatrix::Impl::~Impl() {
+  if (refresh_printer_) {
+    refresh_printer_->Stop();
+    refresh_printer_->WaitStopped();
+    delete refresh_printer_;
+  }
   if (updater_) {
     updater_->Stop();
     updater_->WaitStopped();
   }
   delete updater_;
+  delete governor_;
+
+  if (profiler_) {
+    Framebuffer::SetRefreshProfiler(NULL);
+    delete profiler_;
+  }
+
+  if (conversion_pool_) {
+    Framebuffer::SetConversionPool(NULL);
+    delete conversion_pool_;
+  }
 
   // Make sure LEDs are off.
   active_->Clear();
@@ -417,6 +854,9 @@ RGBMatrix::Impl::~Impl() {
   for (size_t i = 0; i < created_frames_.size(); ++i) {
     delete created_frames_[i];
   }
+  for (size_t i = 0; i < free_frames_.size(); ++i) {
+    delete free_frames_[i];
+  }
   delete shared_pixel_mapper_;
 }
 
@@ -470,6 +910,7 @@ void RGBMatrix::Impl::SetGPIO(GPIO *io, bool start_thread) {
                           !params_.disable_hardware_pulsing,
                           params_.pwm_lsb_nanoseconds, params_.pwm_dither_bits,
                           params_.row_address_type);
+    Framebuffer::SetSplitBitplanes(params_.split_bitplanes);
     Framebuffer::InitializePanels(io_, params_.panel_type,
                                   params_.cols * params_.chain_length);
   }
@@ -480,10 +921,15 @@ void RGBMatrix::Impl::SetGPIO(GPIO *io, bool start_thread) {
 
 bool RGBMatrix::Impl::StartRefresh() {
   if (updater_ == NULL && io_ != NULL) {
+    if (params_.min_refresh_rate_hz > 0) {
+      governor_ = new RefreshGovernor(params_.min_refresh_rate_hz,
+                                      params_.pwm_bits,
+                                      params_.pwm_lsb_nanoseconds);
+    }
     updater_ = new UpdateThread(io_, active_, params_.pwm_dither_bits,
-                                params_.show_refresh_rate,
                                 params_.limit_refresh_rate_hz,
-                                !params_.disable_busy_waiting);
+                                !params_.disable_busy_waiting, governor_);
+    updater_->FadeOutputScale(10 * display_brightness_, 0);
     // If we have multiple processors, the kernel
     // jumps around between these, creating some global flicker.
     // So let's tie it to the last CPU available.
@@ -491,20 +937,62 @@ bool RGBMatrix::Impl::StartRefresh() {
     //   core #3 will succeed.
     // The Raspberry Pi1 only has one core, so this affinity
     //   call will simply fail and we keep using the only core.
-    updater_->Start(99, (1<<3));  // Prio: high. Also: put on last CPU.
+    // Output backends have no timing to keep, but refresh as fast as they
+    // can; at realtime priority, they'd starve everything else.
+    const int priority = io_->backend() ? 0 : 99;
+    updater_->Start(priority, (1<<kRefreshCpu));  // Also: put on last CPU.
+
+    if (params_.show_refresh_rate) {
+      refresh_printer_ = new RefreshPrinter(updater_);
+      refresh_printer_->Start();
+    }
   }
   return updater_ != NULL;
 }
 
+bool RGBMatrix::Impl::GetRefreshStats(RefreshStats *stats) const {
+  if (!updater_) return false;
+  updater_->GetStats(stats);
+  return true;
+}
+
+void RGBMatrix::Impl::SetRefreshProfiling(bool enable) {
+  if (enable && !profiler_) profiler_ = new RefreshProfiler();
+  Framebuffer::SetRefreshProfiler(enable ? profiler_ : NULL);
+}
+
+int RGBMatrix::Impl::WriteRefreshProfile(FILE *out) const {
+  if (!profiler_) return 0;
+  return profiler_->Write(out);
+}
+
+void RGBMatrix::Impl::GetRefreshConfig(RefreshConfig *config) const {
+  config->pwm_bits = params_.pwm_bits;
+  config->pwm_dither_bits = params_.pwm_dither_bits;
+  config->pwm_lsb_nanoseconds = params_.pwm_lsb_nanoseconds;
+  if (governor_) {
+    const RefreshGovernor::Level &level = governor_->level();
+    config->pwm_bits = std::min(config->pwm_bits, level.pwm_bits);
+    config->pwm_lsb_nanoseconds
+      = config->pwm_lsb_nanoseconds * level.pulse_permille / 1000;
+  }
+}
+
 FrameCanvas *RGBMatrix::Impl::CreateFrameCanvas() {
-  FrameCanvas *result =
-    new FrameCanvas(new Framebuffer(params_.rows,
-                                    params_.cols * params_.chain_length,
-                                    params_.parallel,
-                                    params_.scan_mode,
-                                    params_.led_rgb_sequence,
-                                    params_.inverse_colors,
-                                    &shared_pixel_mapper_));
+  FrameCanvas *result;
+  if (!free_frames_.empty()) {
+    // All frames of a matrix have the same geometry, so any will do.
+    result = free_frames_.back();
+    free_frames_.pop_back();
+  } else {
+    result = new FrameCanvas(new Framebuffer(params_.rows,
+                                             params_.cols * params_.chain_length,
+                                             params_.parallel,
+                                             params_.scan_mode,
+                                             params_.led_rgb_sequence,
+                                             params_.inverse_colors,
+                                             &shared_pixel_mapper_));
+  }
   if (created_frames_.empty()) {
     // First time. Get defaults from initial Framebuffer.
     do_luminance_correct_ = result->framebuffer()->luminance_correct();
@@ -513,12 +1001,13 @@ FrameCanvas *RGBMatrix::Impl::CreateFrameCanvas() {
   result->framebuffer()->SetPWMBits(params_.pwm_bits);
   result->framebuffer()->set_luminance_correct(do_luminance_correct_);
   result->framebuffer()->SetBrightness(params_.brightness);
+  result->framebuffer()->Clear();  // Recycled frames might have content.
 
   created_frames_.push_back(result);
 
   if (created_frames_.size() % 500 == 0) {
     if (created_frames_.size() == 500) {
-      fprintf(stderr, "CreateFrameCanvas() called %d times; Usually you only want to call it once (or at most a few times) for double-buffering. These frames will not be freed until the end of the program.\n"
+      fprintf(stderr, "CreateFrameCanvas() called %d times; Usually you only want to call it once (or at most a few times) for double-buffering. These frames will not be freed until the end of the program or ReleaseFrameCanvas().\n"
               "Typical reasons: \n"
               "  * Accidentally called CreateFrameCanvas() inside your inner loop (move outside the loop. Create offscreen-canvas once, then re-use. See SwapOnVSync() examples).\n"
               "  * Used to pre-compute many frames (use led_matrix::StreamWriter instead for such use-case. See e.g. led-image-viewer)\n",
@@ -532,20 +1021,80 @@ FrameCanvas *RGBMatrix::Impl::CreateFrameCanvas() {
   return result;
 }
 
+bool RGBMatrix::Impl::ReleaseFrameCanvas(FrameCanvas *canvas) {
+  if (canvas == NULL || canvas == active_) return false;
+  if (updater_ && updater_->IsShowing(canvas)) return false;
+  std::vector<FrameCanvas*>::iterator it
+    = std::find(created_frames_.begin(), created_frames_.end(), canvas);
+  if (it == created_frames_.end()) return false;  // Not ours or released.
+  created_frames_.erase(it);
+
+  // Keep a few around for re-use, but don't hold on to a large peak.
+  if (free_frames_.size() >= kMaxFreeFrameCanvases) {
+    delete canvas;
+    return true;
+  }
+  canvas->framebuffer()->Recycle();
+  free_frames_.push_back(canvas);
+  return true;
+}
+
+void RGBMatrix::Impl::PrepareForRefresh(FrameCanvas *frame) {
+  frame->Commit();
+  frame->framebuffer()->RecomputeLitPlanes();
+  if (params_.compile_output) frame->framebuffer()->CompileOutput();
+}
+
 FrameCanvas *RGBMatrix::Impl::SwapOnVSync(FrameCanvas *other,
                                           unsigned frame_fraction) {
   if (frame_fraction == 0) frame_fraction = 1; // correct user error.
   if (!updater_) return NULL;
+  if (other) {
+    PrepareForRefresh(other);
+  }
   FrameCanvas *const previous = updater_->SwapOnVSync(other, frame_fraction);
   if (other) active_ = other;
   return previous;
 }
 
+FrameCanvas *RGBMatrix::Impl::PublishFrameCanvas(FrameCanvas *frame) {
+  if (!updater_ || frame == NULL) return NULL;
+  PrepareForRefresh(frame);
+  FrameCanvas *const free_frame = updater_->Publish(frame);
+  active_ = frame;
+  // The first time, there is no frame to give back yet: the third buffer.
+  return free_frame ? free_frame : CreateFrameCanvas();
+}
+
+FrameCanvas *RGBMatrix::Impl::PresentFrameCanvas(FrameCanvas *frame,
+                                                 uint64_t present_at_us) {
+  if (!updater_ || frame == NULL) return NULL;
+  PrepareForRefresh(frame);
+  FrameCanvas *const free_frame = updater_->Present(frame, present_at_us);
+  active_ = frame;
+  // Until frames come back from the screen, the queue fills with new ones.
+  return free_frame ? free_frame : CreateFrameCanvas();
+}
+
 uint64_t RGBMatrix::Impl::AwaitInputChange(int timeout_ms) {
   if (!updater_) return 0;
   return updater_->AwaitInputChange(timeout_ms);
 }
 
+void RGBMatrix::Impl::SetInputDebounce(uint64_t bits, uint32_t debounce_us) {
+  if (updater_) updater_->SetInputDebounce(bits, debounce_us);
+}
+
+int RGBMatrix::Impl::ReadInputEvents(InputEvent *events, int max_events,
+                                     int timeout_ms) {
+  if (!updater_) return 0;
+  return updater_->ReadInputEvents(events, max_events, timeout_ms);
+}
+
+int RGBMatrix::Impl::InputEventFd() const {
+  return updater_ ? updater_->input_event_fd() : -1;
+}
+
 bool RGBMatrix::Impl::SetPWMBits(uint8_t value) {
   const bool success = active_->framebuffer()->SetPWMBits(value);
   if (success) {
@@ -571,37 +1120,20 @@ void RGBMatrix::Impl::SetBrightness(uint8_t brightness) {
   params_.brightness = brightness;
 }
 
+void RGBMatrix::Impl::SetDisplayBrightness(uint8_t percent, int fade_ms) {
+  display_brightness_ = std::min<uint8_t>(percent, 100);
+  if (updater_) updater_->FadeOutputScale(10 * display_brightness_, fade_ms);
+}
+
 uint8_t RGBMatrix::Impl::brightness() {
   return params_.brightness;
 }
 
 bool RGBMatrix::Impl::ApplyPixelMapper(const PixelMapper *mapper) {
   if (mapper == NULL) return true;
-  using internal::PixelDesignatorMap;
-  const int old_width = shared_pixel_mapper_->width();
-  const int old_height = shared_pixel_mapper_->height();
-  int new_width, new_height;
-  if (!mapper->GetSizeMapping(old_width, old_height, &new_width, &new_height)) {
-    return false;
-  }
-  PixelDesignatorMap *new_mapper = new PixelDesignatorMap(
-    new_width, new_height, shared_pixel_mapper_->GetFillColorBits());
-  for (int y = 0; y < new_height; ++y) {
-    for (int x = 0; x < new_width; ++x) {
-      int orig_x = -1, orig_y = -1;
-      mapper->MapVisibleToMatrix(old_width, old_height,
-                                 x, y, &orig_x, &orig_y);
-      if (orig_x < 0 || orig_y < 0 ||
-          orig_x >= old_width || orig_y >= old_height) {
-        fprintf(stderr, "Error in PixelMapper: (%d, %d) -> (%d, %d) [range: "
-                "%dx%d]\n", x, y, orig_x, orig_y, old_width, old_height);
-        continue;
-      }
-      const internal::PixelDesignator *orig_designator;
-      orig_designator = shared_pixel_mapper_->get(orig_x, orig_y);
-      *new_mapper->get(x, y) = *orig_designator;
-    }
-  }
+  internal::PixelDesignatorMap *const new_mapper =
+    internal::ApplyPixelMapper(*mapper, shared_pixel_mapper_);
+  if (new_mapper == NULL) return false;
   delete shared_pixel_mapper_;
   shared_pixel_mapper_ = new_mapper;
   return true;
@@ -665,9 +1197,20 @@ RGBMatrix *RGBMatrix::CreateFromOptions(const RGBMatrix::Options &options,
             runtime_options.gpio_slowdown);
     return NULL;
   }
+  if (runtime_options.max_panel_clock_khz < 0) {
+    fprintf(stderr, "--led-max-panel-clock-khz=%d can't be negative\n",
+            runtime_options.max_panel_clock_khz);
+    return NULL;
+  }
+
+  // Output backends other than the GPIO registers don't need the hardware.
+  const char *const backend_spec = runtime_options.output_backend;
+  const bool use_backend = (backend_spec != NULL && *backend_spec != '\0'
+                            && strcasecmp(backend_spec, "gpio") != 0);
+  const bool init_gpio = runtime_options.do_gpio_init || use_backend;
 
   static GPIO io;  // This static var is a little bit icky.
-  if (runtime_options.do_gpio_init
+  if (runtime_options.do_gpio_init && !use_backend
       && !io.Init(runtime_options.gpio_slowdown)) {
     fprintf(stderr, "Must run as root to be able to access /dev/mem\n"
             "Prepend 'sudo' to the command\n");
@@ -679,9 +1222,28 @@ RGBMatrix *RGBMatrix::CreateFromOptions(const RGBMatrix::Options &options,
   }
 
   RGBMatrix::Impl *result = new RGBMatrix::Impl(NULL, options);
+  if (use_backend) {
+    // Needs the hardware mapping, which the Impl has just initialized.
+    GPIOBackend *const backend =
+      CreateOutputBackend(backend_spec, Framebuffer::hardware_mapping(),
+                          options.cols * options.chain_length, options.rows,
+                          options.parallel, options.row_address_type, &error);
+    if (backend == NULL || !io.Init(backend)) {
+      fprintf(stderr, "%s", error.c_str());
+      delete backend;
+      delete result;
+      return NULL;
+    }
+  } else if (runtime_options.do_gpio_init
+             && runtime_options.max_panel_clock_khz > 0) {
+    // Before the outputs are initialized, so the panel doesn't see it.
+    SlowdownTuner tuner(&io, Framebuffer::hardware_mapping(),
+                        options.cols * options.chain_length);
+    io.SetSlowdown(tuner.Tune(runtime_options.max_panel_clock_khz));
+  }
   // Allowing daemon also means we are allowed to start the thread now.
   const bool allow_daemon = !(runtime_options.daemon < 0);
-  if (runtime_options.do_gpio_init)
+  if (init_gpio)
     result->SetGPIO(&io, allow_daemon);
 
   // TODO(hzeller): if we disallow daemon, then we might also disallow
@@ -715,6 +1277,52 @@ RGBMatrix *RGBMatrix::CreateFromFlags(int *argc, char ***argv,
 FrameCanvas *RGBMatrix::CreateFrameCanvas() {
   return impl_->CreateFrameCanvas();
 }
+
+bool RGBMatrix::ReleaseFrameCanvas(FrameCanvas *canvas) {
+  return impl_->ReleaseFrameCanvas(canvas);
+}
+FrameCanvas *RGBMatrix::PublishFrameCanvas(FrameCanvas *frame) {
+  return impl_->PublishFrameCanvas(frame);
+}
+
+FrameCanvas *RGBMatrix::PresentFrameCanvas(FrameCanvas *frame,
+                                           uint64_t present_at_us) {
+  return impl_->PresentFrameCanvas(frame, present_at_us);
+}
+
+bool RGBMatrix::GetRefreshStats(RefreshStats *stats) const {
+  return impl_->GetRefreshStats(stats);
+}
+
+void RGBMatrix::SetRefreshProfiling(bool enable) {
+  impl_->SetRefreshProfiling(enable);
+}
+
+int RGBMatrix::WriteRefreshProfile(FILE *out) const {
+  return impl_->WriteRefreshProfile(out);
+}
+
+void RGBMatrix::GetRefreshConfig(RefreshConfig *config) const {
+  impl_->GetRefreshConfig(config);
+}
+
+static_assert(RGBMatrix::SleepJitter::kBuckets == kSleepJitterBuckets,
+              "Sleep jitter histograms out of sync");
+
+void RGBMatrix::SetSleepJitterTracking(bool enable) {
+  rgb_matrix::SetSleepJitterTracking(enable);
+}
+
+void RGBMatrix::GetSleepJitter(SleepJitter *jitter) const {
+  rgb_matrix::GetSleepJitter(jitter->sleeps, jitter->pulse_waits);
+}
+
+/* static */ uint64_t RGBMatrix::MonotonicMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 FrameCanvas *RGBMatrix::SwapOnVSync(FrameCanvas *other,
                                     unsigned framerate_fraction) {
   return impl_->SwapOnVSync(other, framerate_fraction);
@@ -735,12 +1343,29 @@ void RGBMatrix::SetBrightness(uint8_t brightness) {
 }
 uint8_t RGBMatrix::brightness() { return impl_->brightness(); }
 
+void RGBMatrix::SetDisplayBrightness(uint8_t percent, int fade_ms) {
+  impl_->SetDisplayBrightness(percent, fade_ms);
+}
+uint8_t RGBMatrix::display_brightness() const {
+  return impl_->display_brightness();
+}
+
 uint64_t RGBMatrix::RequestInputs(uint64_t all_interested_bits) {
   return impl_->RequestInputs(all_interested_bits);
 }
 uint64_t RGBMatrix::AwaitInputChange(int timeout_ms) {
   return impl_->AwaitInputChange(timeout_ms);
 }
+void RGBMatrix::SetInputDebounce(uint64_t bits, uint32_t debounce_us) {
+  impl_->SetInputDebounce(bits, debounce_us);
+}
+int RGBMatrix::ReadInputEvents(InputEvent *events, int max_events,
+                               int timeout_ms) {
+  return impl_->ReadInputEvents(events, max_events, timeout_ms);
+}
+int RGBMatrix::InputEventFd() const {
+  return impl_->InputEventFd();
+}
 
 uint64_t RGBMatrix::RequestOutputs(uint64_t all_interested_bits) {
   return impl_->RequestOutputs(all_interested_bits);
@@ -764,6 +1389,11 @@ void RGBMatrix::SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue)
   impl_->active_->SetPixel(x, y, red, green, blue);
 }
 
+void RGBMatrix::SetPixels(int x, int y, int width, int height,
+                          Color *colors) {
+  impl_->active_->SetPixels(x, y, width, height, colors);
+}
+
 void RGBMatrix::Clear() {
   impl_->active_->Clear();
 }
@@ -807,4 +1437,21 @@ bool FrameCanvas::Deserialize(const char *data, size_t len) {
 void FrameCanvas::CopyFrom(const FrameCanvas &other) {
   frame_->CopyFrom(other.frame_);
 }
+void FrameCanvas::SetRGBBackBuffer(bool enable) {
+  frame_->SetRGBBackBuffer(enable);
+}
+bool FrameCanvas::has_rgb_back_buffer() const {
+  return frame_->has_rgb_back_buffer();
+}
+void FrameCanvas::Commit() { frame_->Commit(); }
+void FrameCanvas::SetCompactStorage(bool enable) {
+  frame_->SetCompactStorage(enable);
+}
+bool FrameCanvas::has_compact_storage() const {
+  return frame_->has_compact_storage();
+}
+bool FrameCanvas::GetPixel(int x, int y,
+                           uint8_t *red, uint8_t *green, uint8_t *blue) const {
+  return frame_->GetPixel(x, y, red, green, blue);
+}
 }  // end namespace rgb_matrix
@@ -41,7 +41,9 @@ RuntimeOptions::RuntimeOptions() :
   drop_privileges(1),   // Encourage good practice: drop privileges by default.
   do_gpio_init(true),
   drop_priv_user("daemon"),
-  drop_priv_group("daemon")
+  drop_priv_group("daemon"),
+  max_panel_clock_khz(0),
+  output_backend(NULL)
 {
   // Nothing to see here.
 }
@@ -186,10 +188,20 @@ static bool FlagInit(int &argc, char **&argv,
       if (ConsumeIntFlag("limit-refresh", it, end,
                          &mopts->limit_refresh_rate_hz, &err))
         continue;
+      if (ConsumeIntFlag("conversion-threads", it, end,
+                         &mopts->conversion_threads, &err))
+        continue;
+      if (ConsumeIntFlag("min-refresh", it, end,
+                         &mopts->min_refresh_rate_hz, &err))
+        continue;
       if (ConsumeBoolFlag("show-refresh", it, &mopts->show_refresh_rate))
         continue;
       if (ConsumeBoolFlag("inverse", it, &mopts->inverse_colors))
         continue;
+      if (ConsumeBoolFlag("split-bitplanes", it, &mopts->split_bitplanes))
+        continue;
+      if (ConsumeBoolFlag("compile-output", it, &mopts->compile_output))
+        continue;
       // We don't have a swap_green_blue option anymore, but we simulate the
       // flag for a while.
       bool swap_green_blue;
@@ -225,6 +237,13 @@ static bool FlagInit(int &argc, char **&argv,
       //-- Runtime options.
       if (ConsumeIntFlag("slowdown-gpio", it, end, &ropts->gpio_slowdown, &err))
         continue;
+      if (ConsumeIntFlag("max-panel-clock-khz", it, end,
+                         &ropts->max_panel_clock_khz, &err))
+        continue;
+      if (ConsumeStringFlag("output-backend", it, end,
+                            &ropts->output_backend, &err)) {
+        continue;
+      }
       if (ropts->daemon >= 0 && ConsumeBoolFlag("daemon", it, &bool_scratch)) {
         ropts->daemon = bool_scratch ? 1 : 0;
         continue;
@@ -335,6 +354,8 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           "\t--led-%sshow-refresh        : %show refresh rate.\n"
           "\t--led-limit-refresh=<Hz>  : Limit refresh rate to this frequency in Hz. Useful to keep a\n"
           "\t                            constant refresh rate on loaded system. 0=no limit. Default: %d\n"
+          "\t--led-min-refresh=<Hz>    : Reduce pwm bits and brightness as needed to stay above\n"
+          "\t                            this refresh rate in Hz. 0=off. Default: %d\n"
           "\t--led-%sinverse             "
           ": Switch if your matrix has inverse colors %s.\n"
           "\t--led-rgb-sequence        : Switch if your matrix has led colors "
@@ -343,9 +364,15 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           "(Default: %d)\n"
           "\t--led-pwm-dither-bits=<0..2> : Time dithering of lower bits "
           "(Default: 0)\n"
+          "\t--led-%ssplit-bitplanes    : %spread long bitplanes over the "
+          "refresh; less flicker on cameras.\n"
+          "\t--led-%scompile-output     : %sompile frames on swap; faster "
+          "refresh of rarely changing content.\n"
           "\t--led-%shardware-pulse   : %sse hardware pin-pulse generation.\n"
           "\t--led-panel-type=<name>   : Needed to initialize special panels. Supported: 'FM6126A', 'FM6127'\n"
-          "\t--led-%sbusy-waiting     : %sse busy waiting when limiting refresh rate.\n",
+          "\t--led-%sbusy-waiting     : %sse busy waiting when limiting refresh rate.\n"
+          "\t--led-conversion-threads=<0..%d> : Threads helping to convert "
+          "canvases with RGB back buffer (Default: %d).\n",
           d.hardware_mapping,
           d.rows, d.cols, d.chain_length, d.parallel,
           (int) muxers.size(), CreateAvailableMultiplexString(muxers).c_str(),
@@ -353,13 +380,16 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           internal::Framebuffer::kBitPlanes, d.pwm_bits,
           d.brightness, d.scan_mode,
           d.show_refresh_rate ? "no-" : "", d.show_refresh_rate ? "Don't s" : "S",
-          d.limit_refresh_rate_hz,
+          d.limit_refresh_rate_hz, d.min_refresh_rate_hz,
           d.inverse_colors ? "no-" : "",    d.inverse_colors ? "off" : "on",
           d.pwm_lsb_nanoseconds,
+          d.split_bitplanes ? "no-" : "", d.split_bitplanes ? "Don't s" : "S",
+          d.compile_output ? "no-" : "", d.compile_output ? "Don't c" : "C",
           !d.disable_hardware_pulsing ? "no-" : "",
           !d.disable_hardware_pulsing ? "Don't u" : "U",
           !d.disable_busy_waiting ? "no-" : "",
-          !d.disable_busy_waiting ? "Don't u" : "U");
+          !d.disable_busy_waiting ? "Don't u" : "U",
+          RGBMatrix::kMaxConversionThreads, d.conversion_threads);
 
   fprintf(out,
           "\t--led-slowdown-gpio=<%d..4>: "
@@ -368,6 +398,14 @@ void PrintMatrixFlags(FILE *out, const RGBMatrix::Options &d,
           (LED_MATRIX_ALLOW_BARRIER_DELAY ? -1 : 0), r.gpio_slowdown,
           LED_MATRIX_ALLOW_BARRIER_DELAY ? "Use -1 for memory barrier approach"
                                          : "");
+  fprintf(out,
+          "\t--led-max-panel-clock-khz=<kHz>: Measure the fastest "
+          "--led-slowdown-gpio for panels\n"
+          "\t                          accepting this clock; cached per board "
+          "(Default: %d = off).\n", r.max_panel_clock_khz);
+  fprintf(out,
+          "\t--led-output-backend=<gpio|null|raw:<file>>: Write GPIO, "
+          "discard, or write raw RGB frames (Default: gpio).\n");
   if (r.daemon >= 0) {
     const bool on = (r.daemon > 0);
     fprintf(out,
@@ -467,6 +505,24 @@ bool RGBMatrix::Options::Validate(std::string *err_in) const {
     success = false;
   }
 
+  if (min_refresh_rate_hz < 0) {
+    err->append("Invalid min-refresh; needs to be 0 (off) or positive.\n");
+    success = false;
+  } else if (min_refresh_rate_hz > 0 && limit_refresh_rate_hz > 0
+             && min_refresh_rate_hz > limit_refresh_rate_hz) {
+    err->append("min-refresh can't be larger than limit-refresh.\n");
+    success = false;
+  }
+
+  if (conversion_threads < 0 || conversion_threads > kMaxConversionThreads) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "Invalid range of conversion-threads (0..%d allowed).\n",
+             kMaxConversionThreads);
+    err->append(buffer);
+    success = false;
+  }
+
   if (led_rgb_sequence == NULL || strlen(led_rgb_sequence) != 3) {
     err->append("led-sequence needs to be three characters long.\n");
     success = false;
@@ -0,0 +1,85 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef RPI_RGBMATRIX_OUTPUT_BACKEND_INTERNAL_H
+#define RPI_RGBMATRIX_OUTPUT_BACKEND_INTERNAL_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "gpio.h"
+#include "hardware-mapping.h"
+#include "simulated-panel-internal.h"
+
+namespace rgb_matrix {
+namespace internal {
+// Backends the matrix can be created with instead of writing the GPIO
+// registers (RuntimeOptions::output_backend). With these, the whole
+// rendering and refresh path runs on any Linux host at full speed, e.g. to
+// profile it.
+
+// Discards all output; only counts what would have been done.
+class NullGPIOBackend : public GPIOBackend {
+public:
+  NullGPIOBackend() : register_writes_(0), pulse_nanos_(0), frames_(0) {}
+
+  virtual void WriteSetBits(gpio_bits_t value) { ++register_writes_; }
+  virtual void WriteClrBits(gpio_bits_t value) { ++register_writes_; }
+  virtual void Pulse(gpio_bits_t bits, long nanos) { pulse_nanos_ += nanos; }
+  virtual void EndOfFrame() { ++frames_; }
+
+  int64_t register_writes() const { return register_writes_; }
+  int64_t pulse_nanos() const { return pulse_nanos_; }
+  int64_t frames() const { return frames_; }
+
+private:
+  int64_t register_writes_;
+  int64_t pulse_nanos_;
+  int64_t frames_;
+};
+
+// Decodes the output as the panel would show it (see SimulatedPanel) and
+// writes each refreshed frame to a file descriptor as raw 8-bit RGB,
+// columns x (rows * parallel) pixels. To watch it, e.g.
+//   ffplay -f rawvideo -pixel_format rgb24 -video_size 64x32 <fifo>
+// As every refresh is written, --led-limit-refresh keeps files manageable.
+class RawFrameBackend : public SimulatedPanel {
+public:
+  // Takes ownership of "fd".
+  RawFrameBackend(int fd, const HardwareMapping &h, int columns, int rows,
+                  int parallel, int row_address_type);
+  virtual ~RawFrameBackend();
+
+  virtual void EndOfFrame();
+
+private:
+  const int width_;
+  const int height_;
+  int fd_;   // -1 after a failed write.
+  std::vector<uint8_t> frame_;
+};
+
+// Creates the backend named by "spec": "null", or "raw:<filename>" for a
+// RawFrameBackend writing to the file or fifo. Returns NULL and sets "err"
+// if the spec is not valid or the file can't be opened. "gpio", the direct
+// register access, doesn't need a backend; this returns NULL without error.
+GPIOBackend *CreateOutputBackend(const char *spec, const HardwareMapping &h,
+                                 int columns, int rows, int parallel,
+                                 int row_address_type, std::string *err);
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_OUTPUT_BACKEND_INTERNAL_H
@@ -0,0 +1,87 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "output-backend-internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+namespace rgb_matrix {
+namespace internal {
+RawFrameBackend::RawFrameBackend(int fd, const HardwareMapping &h,
+                                 int columns, int rows, int parallel,
+                                 int row_address_type)
+  : SimulatedPanel(h, columns, rows, parallel, row_address_type),
+    width_(columns), height_(rows * parallel), fd_(fd),
+    frame_(columns * rows * parallel * 3, 0) {
+}
+
+RawFrameBackend::~RawFrameBackend() {
+  if (fd_ >= 0) close(fd_);
+}
+
+void RawFrameBackend::EndOfFrame() {
+  uint8_t *pixel = frame_.data();
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x, pixel += 3) {
+      if (!GetPixel(x, y, pixel, pixel + 1, pixel + 2))
+        pixel[0] = pixel[1] = pixel[2] = 0;
+    }
+  }
+  Reset();
+  if (fd_ < 0) return;
+  const uint8_t *data = frame_.data();
+  size_t remaining = frame_.size();
+  while (remaining > 0) {
+    const ssize_t w = write(fd_, data, remaining);
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) {
+      // E.g. the disk is full. Keep refreshing, but stop writing.
+      close(fd_);
+      fd_ = -1;
+      return;
+    }
+    data += w;
+    remaining -= w;
+  }
+}
+
+GPIOBackend *CreateOutputBackend(const char *spec, const HardwareMapping &h,
+                                 int columns, int rows, int parallel,
+                                 int row_address_type, std::string *err) {
+  if (spec == NULL || *spec == '\0' || strcasecmp(spec, "gpio") == 0)
+    return NULL;
+  if (strcasecmp(spec, "null") == 0)
+    return new NullGPIOBackend();
+  if (strncasecmp(spec, "raw:", 4) == 0 && spec[4] != '\0') {
+    const char *filename = spec + 4;
+    const int fd = open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd < 0) {
+      err->append("Can't open output backend file ").append(filename)
+        .append(": ").append(strerror(errno)).append("\n");
+      return NULL;
+    }
+    return new RawFrameBackend(fd, h, columns, rows, parallel,
+                               row_address_type);
+  }
+  err->append("Unknown output backend '").append(spec)
+    .append("'. Should be one of gpio, null or raw:<filename>.\n");
+  return NULL;
+}
+}  // namespace internal
+}  // namespace rgb_matrix
@@ -0,0 +1,86 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+#ifndef RPI_RGBMATRIX_REFRESH_GOVERNOR_INTERNAL_H
+#define RPI_RGBMATRIX_REFRESH_GOVERNOR_INTERNAL_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+namespace rgb_matrix {
+namespace internal {
+// Keeps the refresh rate above a floor by stepping down a ladder of output
+// configurations: first the lowest bitplanes down to kKeepPwmBits, then
+// shorter pulses (as a shorter pwm-lsb-nanoseconds), then more bitplanes.
+// Steps back up once there is room again.
+//
+// PWM dithering is not a step: it needs different bitplane timings in
+// the pulser, which are fixed when the refresh starts.
+//
+// Update() is called by the refresh thread only; level() can be read from
+// any thread.
+class RefreshGovernor {
+public:
+  struct Level {
+    int pulse_permille;  // Pulse length relative to the configured one.
+    int pwm_bits;        // Most bitplanes shown.
+  };
+
+  RefreshGovernor(int min_refresh_hz, int pwm_bits, int pwm_lsb_nanoseconds);
+
+  // Call after every refresh. Returns true if the level changed.
+  bool Update(uint32_t now_us);
+
+  const Level &level() const {
+    return ladder_[current_.load(std::memory_order_relaxed)];
+  }
+
+private:
+  // The refresh rate is measured over windows of this length.
+  static constexpr uint32_t kWindowUsec = 250 * 1000;
+  // Stay on a level at least that long before stepping up again.
+  static constexpr uint32_t kMinDwellUsec = 2 * 1000 * 1000;
+  // Measurements of levels that we left are trusted that long.
+  static constexpr uint32_t kMeasurementValidUsec = 30 * 1000 * 1000;
+  // Step up only if that level is expected to exceed the floor by 10%.
+  static constexpr int kStepUpMarginPercent = 110;
+
+  // Don't go below what Options::Validate() allows for pwm_lsb_nanoseconds.
+  static constexpr int kMinLsbNanoseconds = 50;
+  static constexpr int kMinPwmBits = 5;
+  // Bitplanes given up before pulses are shortened.
+  static constexpr int kKeepPwmBits = 8;
+
+  struct Measurement {
+    uint32_t hz;
+    uint32_t at_us;
+    bool valid;
+  };
+
+  void SwitchTo(int level, uint32_t now_us);
+
+  const uint32_t min_refresh_hz_;
+  std::vector<Level> ladder_;             // Best first.
+  std::vector<Measurement> measured_;     // Last refresh rate of each level.
+  std::atomic<int> current_;
+
+  uint32_t level_start_us_;
+  uint32_t window_start_us_;
+  uint32_t window_refreshes_;
+};
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_REFRESH_GOVERNOR_INTERNAL_H
@@ -0,0 +1,91 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "refresh-governor-internal.h"
+
+namespace rgb_matrix {
+namespace internal {
+RefreshGovernor::RefreshGovernor(int min_refresh_hz, int pwm_bits,
+                                 int pwm_lsb_nanoseconds)
+  : min_refresh_hz_(min_refresh_hz), current_(0),
+    level_start_us_(0), window_start_us_(0), window_refreshes_(0) {
+  // The lowest bitplanes cost a full clock-in for very little pulse time,
+  // so dropping them first gains most. Down to kKeepPwmBits, this is
+  // hardly visible.
+  Level level = { 1000, pwm_bits };
+  ladder_.push_back(level);
+  while (level.pwm_bits > kKeepPwmBits) {
+    --level.pwm_bits;
+    ladder_.push_back(level);
+  }
+  // Shorter pulses keep the remaining color depth, but make the display
+  // darker; shorten them in steps of 20%.
+  for (;;) {
+    const int next = level.pulse_permille * 4 / 5;
+    if (pwm_lsb_nanoseconds * next / 1000 < kMinLsbNanoseconds) break;
+    level.pulse_permille = next;
+    ladder_.push_back(level);
+  }
+  // Then give up more bitplanes.
+  while (level.pwm_bits > kMinPwmBits) {
+    --level.pwm_bits;
+    ladder_.push_back(level);
+  }
+  const Measurement none = { 0, 0, false };
+  measured_.resize(ladder_.size(), none);
+}
+
+void RefreshGovernor::SwitchTo(int level, uint32_t now_us) {
+  current_.store(level, std::memory_order_relaxed);
+  level_start_us_ = now_us;
+}
+
+bool RefreshGovernor::Update(uint32_t now_us) {
+  if (window_refreshes_++ == 0) {
+    window_start_us_ = now_us;
+    return false;
+  }
+  const uint32_t elapsed_us = now_us - window_start_us_;
+  if (elapsed_us < kWindowUsec) return false;
+
+  // Refreshes since the first one of the window.
+  const uint32_t hz = (uint64_t)(window_refreshes_ - 1) * 1000000 / elapsed_us;
+  window_refreshes_ = 0;
+
+  const int current = current_.load(std::memory_order_relaxed);
+  const Measurement now_measured = { hz, now_us, true };
+  measured_[current] = now_measured;
+
+  if (hz < min_refresh_hz_) {
+    if (current + 1 >= (int)ladder_.size()) return false;  // Best we can do.
+    SwitchTo(current + 1, now_us);
+    return true;
+  }
+
+  // Step up only if there is room now, and if the better level didn't
+  // recently turn out to be too slow; otherwise we'd oscillate.
+  if (current == 0 || now_us - level_start_us_ < kMinDwellUsec) return false;
+  const uint32_t wanted_hz = min_refresh_hz_ * kStepUpMarginPercent / 100;
+  if (hz < wanted_hz) return false;
+  const Measurement &better = measured_[current - 1];
+  if (better.valid && now_us - better.at_us < kMeasurementValidUsec
+      && better.hz < wanted_hz) {
+    return false;
+  }
+  SwitchTo(current - 1, now_us);
+  return true;
+}
+}  // namespace internal
+}  // namespace rgb_matrix
@@ -0,0 +1,91 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+#ifndef RPI_RGBMATRIX_REFRESH_PROFILER_INTERNAL_H
+#define RPI_RGBMATRIX_REFRESH_PROFILER_INTERNAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <atomic>
+
+namespace rgb_matrix {
+namespace internal {
+// Records how long each phase of showing a bitplane takes, for offline
+// analysis. Written by the refresh thread only; the most recent kCapacity
+// bitplanes are kept in a ring that can be written out at any time.
+class RefreshProfiler {
+public:
+  enum Phase {
+    kClockIn,           // Clocking in the columns of the bitplane.
+    kOutputEnableWait,  // Waiting for the pulse of the previous bitplane.
+    kAddressSet,        // Setting the row address.
+    kStrobe,            // Latching the data and starting the pulse.
+    kPhases
+  };
+
+  static constexpr unsigned kCapacity = 1 << 14;
+
+  RefreshProfiler();
+  ~RefreshProfiler();
+
+  // Refresh thread side.
+  void BeginFrame() {
+    ++frame_;
+    last_ns_ = NowNanos();
+  }
+  void BeginPlane(int double_row, int plane) {
+    current_.row = double_row;
+    current_.plane = plane;
+  }
+  void EndPhase(Phase phase) {
+    const uint64_t now = NowNanos();
+    current_.phase_ns[phase] = now - last_ns_;
+    last_ns_ = now;
+  }
+  void EndPlane() {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    current_.frame = frame_;
+    samples_[head % kCapacity] = current_;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  // Write the recorded bitplanes, oldest first, as CSV with one line per
+  // bitplane. Returns the number of bitplanes written.
+  int Write(FILE *out) const;
+
+private:
+  struct Sample {
+    uint32_t frame;
+    uint16_t row;
+    uint16_t plane;
+    uint32_t phase_ns[kPhases];
+  };
+
+  static inline uint64_t NowNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+  Sample *const samples_;
+  std::atomic<uint32_t> head_;  // Number of samples ever recorded.
+  uint32_t frame_;
+  uint64_t last_ns_;
+  Sample current_;
+};
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_REFRESH_PROFILER_INTERNAL_H
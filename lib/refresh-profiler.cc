@@ -0,0 +1,60 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "refresh-profiler-internal.h"
+
+#include <vector>
+
+namespace rgb_matrix {
+namespace internal {
+RefreshProfiler::RefreshProfiler()
+  : samples_(new Sample[kCapacity]), head_(0), frame_(0), last_ns_(0) {
+  current_.frame = 0;
+  current_.row = 0;
+  current_.plane = 0;
+  for (int i = 0; i < kPhases; ++i) current_.phase_ns[i] = 0;
+}
+
+RefreshProfiler::~RefreshProfiler() {
+  delete [] samples_;
+}
+
+int RefreshProfiler::Write(FILE *out) const {
+  // Copy first, so that the refresh thread is not held up by slow output.
+  const uint32_t end = head_.load(std::memory_order_acquire);
+  const uint32_t begin = end > kCapacity ? end - kCapacity : 0;
+  std::vector<Sample> copy(end - begin);
+  for (uint32_t i = begin; i != end; ++i) {
+    copy[i - begin] = samples_[i % kCapacity];
+  }
+
+  // Samples the refresh thread overwrote while we were copying are
+  // dropped; the slot of the one it might currently write included.
+  const uint32_t now = head_.load(std::memory_order_acquire);
+  const uint32_t first_valid = now >= kCapacity ? now - kCapacity + 1 : 0;
+  const uint32_t skip = first_valid > begin ? first_valid - begin : 0;
+
+  fprintf(out, "frame,row,plane,clock_in_ns,oe_wait_ns,address_ns,strobe_ns\n");
+  int written = 0;
+  for (size_t i = skip; i < copy.size(); ++i, ++written) {
+    const Sample &s = copy[i];
+    fprintf(out, "%u,%u,%u,%u,%u,%u,%u\n", s.frame, s.row, s.plane,
+            s.phase_ns[kClockIn], s.phase_ns[kOutputEnableWait],
+            s.phase_ns[kAddressSet], s.phase_ns[kStrobe]);
+  }
+  return written;
+}
+}  // namespace internal
+}  // namespace rgb_matrix
@@ -0,0 +1,101 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+#ifndef RPI_RGBMATRIX_REFRESH_STATS_INTERNAL_H
+#define RPI_RGBMATRIX_REFRESH_STATS_INTERNAL_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "framebuffer-internal.h"
+#include "led-matrix.h"
+
+namespace rgb_matrix {
+namespace internal {
+// Histogram of microsecond values with buckets about 12% wide. Values are
+// added by one thread only, without locks; any thread can read.
+class MicrosHistogram {
+public:
+  MicrosHistogram();
+
+  void Add(uint32_t usec);
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint32_t min() const { return min_.load(std::memory_order_relaxed); }
+  uint32_t max() const { return max_.load(std::memory_order_relaxed); }
+  uint32_t mean() const;
+
+  // Approximate value below which "percent" of the values are.
+  uint32_t Percentile(int percent) const;
+
+private:
+  // Values below 8 get their own bucket; above, each power of two is
+  // split into 8 buckets. Up to 2^31 usec.
+  static constexpr int kBuckets = 8 + 28 * 8;
+  static int Bucket(uint32_t usec);
+  static uint32_t BucketMidpoint(int bucket);
+
+  std::atomic<uint32_t> buckets_[kBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint32_t> min_;
+  std::atomic<uint32_t> max_;
+};
+
+// Statistics kept by the refresh thread; see RGBMatrix::RefreshStats.
+// The Record*() functions are called from the refresh thread, except
+// RecordDroppedFrame(), which can be called from any thread.
+class RefreshStatsRecorder {
+public:
+  RefreshStatsRecorder();
+
+  void RecordRefresh(uint32_t usec);
+  void RecordSwap(uint32_t latency_usec);
+  void RecordMissedDeadline() { Increment(&missed_deadlines_); }
+  void RecordLateFrame() { Increment(&late_frames_); }
+  void RecordDroppedFrame() { dropped_frames_.fetch_add(1); }
+  void RecordBitplanes(const Framebuffer::OutputCounts &counts) {
+    Add(&bitplanes_, counts.bitplanes);
+    Add(&blank_bitplanes_, counts.blank_bitplanes);
+    Add(&skipped_clock_outs_, counts.skipped_clock_outs);
+  }
+
+  void Get(RGBMatrix::RefreshStats *stats) const;
+
+private:
+  // Refreshes in the first moments after start are janky; they are counted,
+  // but their time is not part of the histogram.
+  static constexpr uint32_t kWarmupUsec = 2000 * 1000;
+
+  static void Add(std::atomic<uint64_t> *value, uint64_t amount) {
+    value->store(value->load(std::memory_order_relaxed) + amount,
+                 std::memory_order_relaxed);
+  }
+  static void Increment(std::atomic<uint64_t> *value) { Add(value, 1); }
+
+  std::atomic<uint64_t> refreshes_;
+  uint64_t warmup_spent_usec_;  // Refresh thread only.
+  MicrosHistogram refresh_usec_;
+  MicrosHistogram swap_latency_usec_;
+  std::atomic<uint64_t> missed_deadlines_;
+  std::atomic<uint64_t> late_frames_;
+  std::atomic<uint64_t> dropped_frames_;
+  std::atomic<uint64_t> bitplanes_;
+  std::atomic<uint64_t> blank_bitplanes_;
+  std::atomic<uint64_t> skipped_clock_outs_;
+};
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_REFRESH_STATS_INTERNAL_H
@@ -0,0 +1,119 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "refresh-stats-internal.h"
+
+namespace rgb_matrix {
+namespace internal {
+MicrosHistogram::MicrosHistogram()
+  : count_(0), sum_(0), min_(UINT32_MAX), max_(0) {
+  for (int i = 0; i < kBuckets; ++i) buckets_[i].store(0);
+}
+
+/* static */ int MicrosHistogram::Bucket(uint32_t usec) {
+  if (usec < 8) return usec;
+  if (usec >= (1u << 31)) return kBuckets - 1;
+  const int octave = 31 - __builtin_clz(usec);  // >= 3
+  return 8 * (octave - 2) + ((usec >> (octave - 3)) & 7);
+}
+
+/* static */ uint32_t MicrosHistogram::BucketMidpoint(int bucket) {
+  if (bucket < 8) return bucket;
+  const int octave = bucket / 8 + 2;
+  const uint32_t start = (8u + bucket % 8) << (octave - 3);
+  return start + (1u << (octave - 3)) / 2;
+}
+
+void MicrosHistogram::Add(uint32_t usec) {
+  // Only one writer, so no need for read-modify-write operations.
+  std::atomic<uint32_t> &bucket = buckets_[Bucket(usec)];
+  bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+  sum_.store(sum_.load(std::memory_order_relaxed) + usec,
+             std::memory_order_relaxed);
+  if (usec < min_.load(std::memory_order_relaxed))
+    min_.store(usec, std::memory_order_relaxed);
+  if (usec > max_.load(std::memory_order_relaxed))
+    max_.store(usec, std::memory_order_relaxed);
+  count_.store(count_.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+}
+
+uint32_t MicrosHistogram::mean() const {
+  const uint64_t n = count_.load(std::memory_order_acquire);
+  return n ? sum_.load(std::memory_order_relaxed) / n : 0;
+}
+
+uint32_t MicrosHistogram::Percentile(int percent) const {
+  const uint64_t n = count_.load(std::memory_order_acquire);
+  if (n == 0) return 0;
+  const uint64_t wanted = (n * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= wanted) {
+      // Midpoint of bucket, but never outside of what we have seen.
+      const uint32_t value = BucketMidpoint(i);
+      if (value < min()) return min();
+      if (value > max()) return max();
+      return value;
+    }
+  }
+  return max();
+}
+
+RefreshStatsRecorder::RefreshStatsRecorder()
+  : refreshes_(0), warmup_spent_usec_(0),
+    missed_deadlines_(0), late_frames_(0), dropped_frames_(0),
+    bitplanes_(0), blank_bitplanes_(0), skipped_clock_outs_(0) {
+}
+
+void RefreshStatsRecorder::RecordRefresh(uint32_t usec) {
+  Increment(&refreshes_);
+  if (warmup_spent_usec_ < kWarmupUsec) {
+    warmup_spent_usec_ += usec;
+    return;
+  }
+  refresh_usec_.Add(usec);
+}
+
+void RefreshStatsRecorder::RecordSwap(uint32_t latency_usec) {
+  swap_latency_usec_.Add(latency_usec);
+}
+
+void RefreshStatsRecorder::Get(RGBMatrix::RefreshStats *stats) const {
+  stats->refreshes = refreshes_.load(std::memory_order_relaxed);
+  stats->min_refresh_usec = refresh_usec_.count() ? refresh_usec_.min() : 0;
+  stats->max_refresh_usec = refresh_usec_.max();
+  stats->mean_refresh_usec = refresh_usec_.mean();
+  stats->p50_refresh_usec = refresh_usec_.Percentile(50);
+  stats->p90_refresh_usec = refresh_usec_.Percentile(90);
+  stats->p99_refresh_usec = refresh_usec_.Percentile(99);
+
+  stats->swaps = swap_latency_usec_.count();
+  stats->mean_swap_latency_usec = swap_latency_usec_.mean();
+  stats->p99_swap_latency_usec = swap_latency_usec_.Percentile(99);
+  stats->max_swap_latency_usec = swap_latency_usec_.max();
+
+  stats->missed_deadlines = missed_deadlines_.load(std::memory_order_relaxed);
+  stats->late_frames = late_frames_.load(std::memory_order_relaxed);
+  stats->dropped_frames = dropped_frames_.load(std::memory_order_relaxed);
+  stats->bitplanes = bitplanes_.load(std::memory_order_relaxed);
+  stats->blank_bitplanes = blank_bitplanes_.load(std::memory_order_relaxed);
+  stats->skipped_clock_outs
+    = skipped_clock_outs_.load(std::memory_order_relaxed);
+}
+}  // namespace internal
+}  // namespace rgb_matrix
@@ -0,0 +1,119 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+#ifndef RPI_RGBMATRIX_SIMULATED_PANEL_INTERNAL_H
+#define RPI_RGBMATRIX_SIMULATED_PANEL_INTERNAL_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "gpio.h"
+#include "hardware-mapping.h"
+
+namespace rgb_matrix {
+namespace internal {
+// A GPIOBackend that decodes the writes as a chain of HUB75 panels would:
+// colors are shifted in on the rising clock edge, latched on the rising
+// strobe edge and shown in the addressed row while output enable is pulsed.
+// Accumulates the on-time of each LED, so that the refresh path can be
+// tested and benchmarked without hardware:
+//
+//   SimulatedPanel panel(*mapping, 64, 32, 1, 0);
+//   GPIO io;
+//   io.Init(&panel);
+//   ... Framebuffer::InitGPIO(&io, ...); frame->DumpToMatrix(&io, 0);
+//
+// Pixels are as the Framebuffer addresses them: x is the column in the
+// order clocked in, y the row of the chain, chains below each other.
+// Row addresses are decoded for the direct (0), direct ABCD line (2) and
+// SM5266 (4) row address types; with others, pulses are only counted.
+class SimulatedPanel : public GPIOBackend {
+public:
+  // "columns" is the panel columns times the chain length, "rows" the
+  // rows of a panel.
+  SimulatedPanel(const HardwareMapping &h, int columns, int rows,
+                 int parallel, int row_address_type);
+
+  virtual void WriteSetBits(gpio_bits_t value);
+  virtual void WriteClrBits(gpio_bits_t value);
+  virtual void Pulse(gpio_bits_t bits, long nanos);
+
+  // Forget on-times and counts, e.g. after the first frame.
+  void Reset();
+
+  // Nanoseconds the LED was on; color is 0=red, 1=green, 2=blue.
+  int64_t OnTime(int x, int y, int color) const {
+    return on_ns_[(y * columns_ + x) * 3 + color];
+  }
+
+  // Displayed image: on-time relative to the time the row was shown, so a
+  // LED on in every pulse of its row is 255. Linear, no luminance
+  // correction applied. Returns false if outside or never shown.
+  bool GetPixel(int x, int y, uint8_t *red, uint8_t *green,
+                uint8_t *blue) const;
+
+  // If enabled, each register write is kept in writes() in the order
+  // received, e.g. to compare two ways of output bit-for-bit.
+  struct Write {
+    bool set;  // Set register, otherwise clear register.
+    gpio_bits_t bits;
+  };
+  void SetRecording(bool on) { recording_ = on; }
+  const std::vector<Write> &writes() const { return writes_; }
+
+  // Counts since the last Reset().
+  long register_writes() const { return register_writes_; }
+  long clocks() const { return clocks_; }
+  long latches() const { return latches_; }
+  long pulses() const { return pulses_; }
+  long unaddressed_pulses() const { return unaddressed_pulses_; }
+
+private:
+  struct ChainBits {
+    gpio_bits_t color[2][3];  // Top and bottom half; red, green, blue.
+  };
+
+  void Apply(gpio_bits_t next);
+  int AddressedRow() const;  // -1 if not decodable.
+
+  const HardwareMapping &h_;
+  const int columns_;
+  const int rows_;
+  const int double_rows_;
+  const int parallel_;
+  const int row_address_type_;
+  std::vector<ChainBits> chains_;
+  gpio_bits_t color_bits_;
+
+  gpio_bits_t out_;                  // Current level of all outputs.
+  std::vector<gpio_bits_t> shift_;   // Ring of the shifted-in color bits.
+  int shift_pos_;                    // Oldest column in shift_.
+  std::vector<gpio_bits_t> latch_;   // Latched columns, first clocked first.
+  uint8_t row_shifter_;              // SM5266 row shift register.
+
+  std::vector<int64_t> on_ns_;       // (y * columns + x) * 3 + color.
+  std::vector<int64_t> row_ns_;      // Time each double row was shown.
+
+  bool recording_;
+  std::vector<Write> writes_;
+  long register_writes_;
+  long clocks_;
+  long latches_;
+  long pulses_;
+  long unaddressed_pulses_;
+};
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_SIMULATED_PANEL_INTERNAL_H
@@ -0,0 +1,173 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "simulated-panel-internal.h"
+
+#include <assert.h>
+
+#include <algorithm>
+
+namespace rgb_matrix {
+namespace internal {
+SimulatedPanel::SimulatedPanel(const HardwareMapping &h, int columns,
+                               int rows, int parallel, int row_address_type)
+  : h_(h), columns_(columns), rows_(rows), double_rows_(rows / 2),
+    parallel_(parallel), row_address_type_(row_address_type),
+    chains_(parallel), color_bits_(0),
+    out_(0), shift_(columns, 0), shift_pos_(0), latch_(columns, 0),
+    row_shifter_(0),
+    on_ns_(columns * rows * parallel * 3, 0), row_ns_(rows / 2, 0),
+    recording_(false) {
+  assert(parallel >= 1 && parallel <= 6);
+  const gpio_bits_t colors[6][2][3] = {
+    { { h.p0_r1, h.p0_g1, h.p0_b1 }, { h.p0_r2, h.p0_g2, h.p0_b2 } },
+    { { h.p1_r1, h.p1_g1, h.p1_b1 }, { h.p1_r2, h.p1_g2, h.p1_b2 } },
+    { { h.p2_r1, h.p2_g1, h.p2_b1 }, { h.p2_r2, h.p2_g2, h.p2_b2 } },
+    { { h.p3_r1, h.p3_g1, h.p3_b1 }, { h.p3_r2, h.p3_g2, h.p3_b2 } },
+    { { h.p4_r1, h.p4_g1, h.p4_b1 }, { h.p4_r2, h.p4_g2, h.p4_b2 } },
+    { { h.p5_r1, h.p5_g1, h.p5_b1 }, { h.p5_r2, h.p5_g2, h.p5_b2 } },
+  };
+  for (int p = 0; p < parallel; ++p) {
+    for (int half = 0; half < 2; ++half) {
+      for (int c = 0; c < 3; ++c) {
+        chains_[p].color[half][c] = colors[p][half][c];
+        color_bits_ |= colors[p][half][c];
+      }
+    }
+  }
+  Reset();
+}
+
+void SimulatedPanel::Reset() {
+  std::fill(on_ns_.begin(), on_ns_.end(), 0);
+  std::fill(row_ns_.begin(), row_ns_.end(), 0);
+  writes_.clear();
+  register_writes_ = 0;
+  clocks_ = 0;
+  latches_ = 0;
+  pulses_ = 0;
+  unaddressed_pulses_ = 0;
+}
+
+void SimulatedPanel::WriteSetBits(gpio_bits_t value) {
+  if (recording_) {
+    const Write write = { true, value };
+    writes_.push_back(write);
+  }
+  Apply(out_ | value);
+}
+
+void SimulatedPanel::WriteClrBits(gpio_bits_t value) {
+  if (recording_) {
+    const Write write = { false, value };
+    writes_.push_back(write);
+  }
+  Apply(out_ & ~value);
+}
+
+void SimulatedPanel::Apply(gpio_bits_t next) {
+  ++register_writes_;
+  const gpio_bits_t rising = next & ~out_;
+  if (rising & h_.clock) {
+    ++clocks_;
+    shift_[shift_pos_] = next & color_bits_;
+    shift_pos_ = (shift_pos_ + 1) % columns_;
+  }
+  if (rising & h_.strobe) {
+    ++latches_;
+    for (int x = 0; x < columns_; ++x) {
+      latch_[x] = shift_[(shift_pos_ + x) % columns_];
+    }
+  }
+  // SM5266: DCK on A shifts in DIN on B while BK on C is high.
+  if (row_address_type_ == 4 && (rising & h_.a) && (next & h_.c)) {
+    row_shifter_ = (row_shifter_ << 1) | ((next & h_.b) ? 1 : 0);
+  }
+  out_ = next;
+}
+
+int SimulatedPanel::AddressedRow() const {
+  int row = 0;
+  switch (row_address_type_) {
+  case 0:  // Binary on ABCDE; lines not needed are don't care.
+    if (out_ & h_.a) row |= 1;
+    if ((out_ & h_.b) && double_rows_ > 2)  row |= 2;
+    if ((out_ & h_.c) && double_rows_ > 4)  row |= 4;
+    if ((out_ & h_.d) && double_rows_ > 8)  row |= 8;
+    if ((out_ & h_.e) && double_rows_ > 16) row |= 16;
+    break;
+  case 2: {  // One of ABCD low.
+    const gpio_bits_t lines[4] = { h_.a, h_.b, h_.c, h_.d };
+    int low = 0;
+    for (int i = 0; i < 4; ++i) {
+      if ((out_ & lines[i]) == 0) {
+        row = i;
+        ++low;
+      }
+    }
+    if (low != 1) return -1;
+    break;
+  }
+  case 4:  // One bit of the shifter high, DE selects the shifter.
+    if (row_shifter_ == 0 || (row_shifter_ & (row_shifter_ - 1)) != 0)
+      return -1;
+    row = __builtin_ctz(row_shifter_);
+    if ((out_ & h_.d) && double_rows_ > 8)  row |= 8;
+    if ((out_ & h_.e) && double_rows_ > 16) row |= 16;
+    break;
+  default:
+    return -1;
+  }
+  return row < double_rows_ ? row : -1;
+}
+
+void SimulatedPanel::Pulse(gpio_bits_t bits, long nanos) {
+  ++pulses_;
+  const int row = AddressedRow();
+  if (row < 0) {
+    ++unaddressed_pulses_;
+    return;
+  }
+  row_ns_[row] += nanos;  // Dark pulses are part of the row's time, too.
+  if ((bits & h_.output_enable) == 0) return;
+  for (int p = 0; p < parallel_; ++p) {
+    for (int half = 0; half < 2; ++half) {
+      const gpio_bits_t *const color = chains_[p].color[half];
+      const int y = p * rows_ + half * double_rows_ + row;
+      int64_t *on = &on_ns_[y * columns_ * 3];
+      for (int x = 0; x < columns_; ++x, on += 3) {
+        const gpio_bits_t latched = latch_[x];
+        if (latched & color[0]) on[0] += nanos;
+        if (latched & color[1]) on[1] += nanos;
+        if (latched & color[2]) on[2] += nanos;
+      }
+    }
+  }
+}
+
+bool SimulatedPanel::GetPixel(int x, int y, uint8_t *red, uint8_t *green,
+                              uint8_t *blue) const {
+  if (x < 0 || x >= columns_ || y < 0 || y >= rows_ * parallel_)
+    return false;
+  const int64_t shown = row_ns_[y % double_rows_];
+  if (shown == 0) return false;
+  const int64_t *on = &on_ns_[(y * columns_ + x) * 3];
+  *red   = (on[0] * 255 + shown / 2) / shown;
+  *green = (on[1] * 255 + shown / 2) / shown;
+  *blue  = (on[2] * 255 + shown / 2) / shown;
+  return true;
+}
+}  // namespace internal
+}  // namespace rgb_matrix
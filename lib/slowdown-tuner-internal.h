@@ -0,0 +1,80 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#ifndef RPI_RGBMATRIX_SLOWDOWN_TUNER_INTERNAL_H
+#define RPI_RGBMATRIX_SLOWDOWN_TUNER_INTERNAL_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "gpio.h"
+#include "hardware-mapping.h"
+
+namespace rgb_matrix {
+namespace internal {
+// Finds the fastest GPIO slowdown a panel can follow. For each slowdown,
+// a row is clocked out the way the Framebuffer does and timed; the panel
+// clock that results is compared to the maximum the panel is specified for.
+//
+// Meant to run before GPIO::InitOutputs(): the writes then only reach the
+// output registers, not the panel, but take the same time.
+//
+// The time comes from NowNanos(), so that tests can drive the tuner with
+// a simulated GPIO (GPIO::Init(GPIOBackend*)) advancing a simulated clock.
+class SlowdownTuner {
+public:
+  // "columns" is the number of columns clocked out per row.
+  SlowdownTuner(GPIO *io, const HardwareMapping &h, int columns);
+  virtual ~SlowdownTuner() {}
+
+  struct Measurement {
+    int slowdown;
+    long row_nanos;   // Fastest time to clock out a row.
+    int clock_khz;    // Panel clock that results from it.
+  };
+
+  // Time clocking out a row with the given slowdown; best of "runs".
+  Measurement Measure(int slowdown, int runs);
+
+  // Measure all slowdowns in [min_slowdown..max_slowdown]. The slowdown
+  // of the GPIO is restored afterwards.
+  std::vector<Measurement> Sweep(int min_slowdown, int max_slowdown,
+                                 int runs);
+
+  // Choose the measurement with the fastest clock that does not exceed
+  // "max_clock_khz". Slowdown -1 (memory barrier) is not necessarily faster
+  // than 0, so this doesn't assume an order. Returns false, and the slowest
+  // measurement, if none is slow enough.
+  static bool Pick(const std::vector<Measurement> &measurements,
+                   int max_clock_khz, Measurement *result);
+
+  // Returns the slowdown for "max_clock_khz" from the cache file if it has
+  // been tuned on this board before, otherwise sweeps the usable range and
+  // caches the result.
+  int Tune(int max_clock_khz);
+
+protected:
+  virtual uint64_t NowNanos();
+
+private:
+  GPIO *const io_;
+  const int columns_;
+  gpio_bits_t color_bits_;
+  gpio_bits_t clock_;
+};
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_SLOWDOWN_TUNER_INTERNAL_H
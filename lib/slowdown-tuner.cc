@@ -0,0 +1,161 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "slowdown-tuner-internal.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SLOWDOWN_CACHE_FILE "/var/cache/rpi-rgb-led-matrix-slowdown"
+
+namespace rgb_matrix {
+namespace internal {
+static const int kMinSlowdown = LED_MATRIX_ALLOW_BARRIER_DELAY ? -1 : 0;
+static const int kMaxSlowdown = 10;  // As accepted by CreateFromOptions().
+static const int kRuns = 20;
+
+SlowdownTuner::SlowdownTuner(GPIO *io, const HardwareMapping &h, int columns)
+  : io_(io), columns_(columns), clock_(h.clock) {
+  color_bits_ = (h.p0_r1 | h.p0_g1 | h.p0_b1 | h.p0_r2 | h.p0_g2 | h.p0_b2
+                 | h.p1_r1 | h.p1_g1 | h.p1_b1 | h.p1_r2 | h.p1_g2 | h.p1_b2
+                 | h.p2_r1 | h.p2_g1 | h.p2_b1 | h.p2_r2 | h.p2_g2 | h.p2_b2
+                 | h.p3_r1 | h.p3_g1 | h.p3_b1 | h.p3_r2 | h.p3_g2 | h.p3_b2
+                 | h.p4_r1 | h.p4_g1 | h.p4_b1 | h.p4_r2 | h.p4_g2 | h.p4_b2
+                 | h.p5_r1 | h.p5_g1 | h.p5_b1 | h.p5_r2 | h.p5_g2 | h.p5_b2);
+}
+
+uint64_t SlowdownTuner::NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+SlowdownTuner::Measurement SlowdownTuner::Measure(int slowdown, int runs) {
+  const gpio_bits_t color_clk_mask = color_bits_ | clock_;
+  io_->SetSlowdown(slowdown);
+  Measurement result;
+  result.slowdown = slowdown;
+  result.row_nanos = -1;
+  for (int run = 0; run < runs; ++run) {
+    const uint64_t start = NowNanos();
+    // Same sequence as Framebuffer::DumpToMatrix(); toggling all colors,
+    // as the worst case for the outputs.
+    for (int col = 0; col < columns_; ++col) {
+      io_->WriteMaskedBits((col & 1) ? color_bits_ : 0, color_clk_mask);
+      io_->SetBits(clock_);
+    }
+    io_->ClearBits(color_clk_mask);
+    const long nanos = NowNanos() - start;
+    if (result.row_nanos < 0 || nanos < result.row_nanos)
+      result.row_nanos = nanos;
+  }
+  result.clock_khz = result.row_nanos > 0
+    ? (int)((int64_t)columns_ * 1000000 / result.row_nanos)
+    : 0;
+  return result;
+}
+
+std::vector<SlowdownTuner::Measurement>
+SlowdownTuner::Sweep(int min_slowdown, int max_slowdown, int runs) {
+  const int original_slowdown = io_->slowdown();
+  std::vector<Measurement> result;
+  for (int slowdown = min_slowdown; slowdown <= max_slowdown; ++slowdown) {
+    result.push_back(Measure(slowdown, runs));
+  }
+  io_->SetSlowdown(original_slowdown);
+  return result;
+}
+
+/* static */ bool SlowdownTuner::Pick(
+  const std::vector<Measurement> &measurements, int max_clock_khz,
+  Measurement *result) {
+  const Measurement *fastest = NULL;
+  const Measurement *slowest = NULL;
+  for (size_t i = 0; i < measurements.size(); ++i) {
+    const Measurement &m = measurements[i];
+    if (m.clock_khz <= 0) continue;  // Nothing measured.
+    if (!slowest || m.clock_khz < slowest->clock_khz)
+      slowest = &m;
+    if (m.clock_khz <= max_clock_khz
+        && (!fastest || m.clock_khz > fastest->clock_khz)) {
+      fastest = &m;
+    }
+  }
+  if (fastest) {
+    *result = *fastest;
+    return true;
+  }
+  if (slowest) *result = *slowest;
+  return false;
+}
+
+static bool ReadSlowdownCache(const char *key, int max_clock_khz,
+                              int *slowdown) {
+  FILE *f = fopen(SLOWDOWN_CACHE_FILE, "r");
+  if (!f) return false;
+  char cached_key[128];
+  int cached_khz, cached_slowdown;
+  const bool success =
+    (fscanf(f, "%127s %d %d", cached_key, &cached_khz, &cached_slowdown) == 3
+     && strcmp(cached_key, key) == 0 && cached_khz == max_clock_khz
+     // Not from a damaged file or another build: only what we could pick.
+     && cached_slowdown >= kMinSlowdown && cached_slowdown <= kMaxSlowdown);
+  fclose(f);
+  if (success) *slowdown = cached_slowdown;
+  return success;
+}
+
+// Best effort; if we can't write it, we tune again next time.
+static void WriteSlowdownCache(const char *key, int max_clock_khz,
+                               int slowdown) {
+  char line[256];
+  const int len = snprintf(line, sizeof(line), "%s %d %d\n", key,
+                           max_clock_khz, slowdown);
+  const int fd = open(SLOWDOWN_CACHE_FILE, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0) return;
+  (void) write(fd, line, len);  // Best effort. Ignore return value.
+  close(fd);
+}
+
+int SlowdownTuner::Tune(int max_clock_khz) {
+  char key[128];
+  GetBoardTimingKey(key, sizeof(key));
+  int slowdown;
+  if (ReadSlowdownCache(key, max_clock_khz, &slowdown))
+    return slowdown;
+
+  const std::vector<Measurement> measurements =
+    Sweep(kMinSlowdown, kMaxSlowdown, kRuns);
+  Measurement picked;
+  picked.clock_khz = 0;
+  if (!Pick(measurements, max_clock_khz, &picked)) {
+    if (picked.clock_khz <= 0)
+      return io_->slowdown();  // Couldn't measure; keep what we have.
+    fprintf(stderr, "Even --led-slowdown-gpio=%d clocks the panel with "
+            "%d kHz, faster than %d kHz.\n",
+            picked.slowdown, picked.clock_khz, max_clock_khz);
+  } else {
+    fprintf(stderr, "Tuned --led-slowdown-gpio=%d: %d kHz panel clock "
+            "(max %d kHz), %ldns per row.\n", picked.slowdown,
+            picked.clock_khz, max_clock_khz, picked.row_nanos);
+  }
+  WriteSlowdownCache(key, max_clock_khz, picked.slowdown);
+  return picked.slowdown;
+}
+}  // namespace internal
+}  // namespace rgb_matrix
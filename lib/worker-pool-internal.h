@@ -0,0 +1,75 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+#ifndef RPI_RGBMATRIX_WORKER_POOL_INTERNAL_H
+#define RPI_RGBMATRIX_WORKER_POOL_INTERNAL_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <vector>
+
+#include "thread.h"
+
+namespace rgb_matrix {
+namespace internal {
+// A small pool of threads that work together with the calling thread on
+// a number of independent slices of a job.
+class WorkerPool {
+public:
+  // The job to be done. Run() is called concurrently for different slices.
+  class Task {
+  public:
+    virtual ~Task() {}
+    virtual void Run(int slice) = 0;
+  };
+
+  // Start "threads" worker threads with the given cpu affinity mask
+  // (0 = no affinity).
+  WorkerPool(int threads, uint32_t cpu_affinity_mask);
+  ~WorkerPool();
+
+  int threads() const { return (int)workers_.size(); }
+
+  // Call task->Run(slice) for each slice in 0..slices-1, distributed to the
+  // workers and the calling thread. Returns when all slices are done.
+  // Only one thread at a time may call Run().
+  void Run(Task *task, int slices);
+
+  // Cpu affinity mask of all available cores except "excluded_core".
+  // Returns 0 if there is no core left.
+  static uint32_t AffinityExcludingCore(int excluded_core);
+
+private:
+  class Worker;
+
+  // Work on slices of the current job until none are left.
+  void WorkOnSlices();
+
+  std::vector<Worker*> workers_;
+
+  Mutex mutex_;
+  pthread_cond_t job_available_;
+  pthread_cond_t job_done_;
+  bool running_;
+  unsigned generation_;  // Incremented for each new job.
+  int busy_workers_;     // Workers still on the current job.
+
+  Task *task_;
+  int slices_;
+  std::atomic<int> next_slice_;
+};
+}  // namespace internal
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_WORKER_POOL_INTERNAL_H
@@ -0,0 +1,109 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "worker-pool-internal.h"
+
+#include <unistd.h>
+
+namespace rgb_matrix {
+namespace internal {
+class WorkerPool::Worker : public Thread {
+public:
+  Worker(WorkerPool *pool) : pool_(pool) {}
+
+  virtual void Run() {
+    unsigned seen_generation = 0;
+    for (;;) {
+      {
+        MutexLock l(&pool_->mutex_);
+        while (pool_->running_ && pool_->generation_ == seen_generation)
+          pool_->mutex_.WaitOn(&pool_->job_available_);
+        if (!pool_->running_) return;
+        seen_generation = pool_->generation_;
+      }
+      pool_->WorkOnSlices();
+      MutexLock l(&pool_->mutex_);
+      if (--pool_->busy_workers_ == 0)
+        pthread_cond_signal(&pool_->job_done_);
+    }
+  }
+
+private:
+  WorkerPool *const pool_;
+};
+
+WorkerPool::WorkerPool(int threads, uint32_t cpu_affinity_mask)
+  : running_(true), generation_(0), busy_workers_(0),
+    task_(NULL), slices_(0), next_slice_(0) {
+  pthread_cond_init(&job_available_, NULL);
+  pthread_cond_init(&job_done_, NULL);
+  for (int i = 0; i < threads; ++i) {
+    Worker *worker = new Worker(this);
+    worker->Start(0, cpu_affinity_mask);
+    workers_.push_back(worker);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    MutexLock l(&mutex_);
+    running_ = false;
+    pthread_cond_broadcast(&job_available_);
+  }
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    delete workers_[i];  // Waits for the thread to finish.
+  }
+  pthread_cond_destroy(&job_available_);
+  pthread_cond_destroy(&job_done_);
+}
+
+void WorkerPool::WorkOnSlices() {
+  int slice;
+  while ((slice = next_slice_.fetch_add(1)) < slices_) {
+    task_->Run(slice);
+  }
+}
+
+void WorkerPool::Run(Task *task, int slices) {
+  if (workers_.empty() || slices <= 1) {
+    for (int i = 0; i < slices; ++i) task->Run(i);
+    return;
+  }
+  {
+    MutexLock l(&mutex_);
+    task_ = task;
+    slices_ = slices;
+    next_slice_.store(0);
+    busy_workers_ = workers_.size();
+    ++generation_;
+    pthread_cond_broadcast(&job_available_);
+  }
+  WorkOnSlices();
+  MutexLock l(&mutex_);
+  while (busy_workers_ > 0)
+    mutex_.WaitOn(&job_done_);
+}
+
+/* static */ uint32_t WorkerPool::AffinityExcludingCore(int excluded_core) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores > 32) cores = 32;
+  uint32_t mask = 0;
+  for (int i = 0; i < cores; ++i) {
+    if (i != excluded_core) mask |= (1u << i);
+  }
+  return mask;
+}
+}  // namespace internal
+}  // namespace rgb_matrix
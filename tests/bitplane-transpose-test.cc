@@ -0,0 +1,94 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Compares TransposeBitplanes() with TransposeBitplanesScalar() on random
+// input. The Makefile links this against each implementation.
+
+#include "bitplane-transpose-internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+using namespace rgb_matrix::internal;
+
+static const int kCases = 20000;
+static const int kMaxCount = 70;  // Covers several vectors and the remainder.
+static const int kPlanes = 11;
+
+static gpio_bits_t RandomBits() {
+  return (gpio_bits_t)random() ^ ((gpio_bits_t)random() << 16);
+}
+
+// Picks a random single bit not in 'used' and adds it there.
+static gpio_bits_t RandomSingleBit(gpio_bits_t *used) {
+  for (;;) {
+    const gpio_bits_t bit = (gpio_bits_t)1 << (random() % 32);
+    if ((*used & bit) == 0) {
+      *used |= bit;
+      return bit;
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  srandom(argc > 1 ? atoi(argv[1]) : 42);
+
+  std::vector<uint16_t> red(kMaxCount), green(kMaxCount), blue(kMaxCount);
+  for (int c = 0; c < kCases; ++c) {
+    const int count = 1 + random() % kMaxCount;
+    const int plane_stride = count + random() % 8;
+    const int first_plane = random() % kPlanes;
+    const int end_plane = first_plane + 1 + random() % (kPlanes - first_plane);
+
+    for (int i = 0; i < count; ++i) {
+      red[i] = random();
+      green[i] = random();
+      blue[i] = random();
+    }
+    gpio_bits_t used = 0;
+    const gpio_bits_t r_bit = RandomSingleBit(&used);
+    const gpio_bits_t g_bit = RandomSingleBit(&used);
+    const gpio_bits_t b_bit = RandomSingleBit(&used);
+    const gpio_bits_t keep_mask = RandomBits() & ~used;
+
+    // Random previous content, also outside of the written range, which
+    // must stay untouched.
+    std::vector<gpio_bits_t> expected(kPlanes * plane_stride);
+    for (size_t i = 0; i < expected.size(); ++i) expected[i] = RandomBits();
+    std::vector<gpio_bits_t> actual = expected;
+
+    TransposeBitplanesScalar(red.data(), green.data(), blue.data(), count,
+                             r_bit, g_bit, b_bit, keep_mask,
+                             first_plane, end_plane,
+                             expected.data(), plane_stride);
+    TransposeBitplanes(red.data(), green.data(), blue.data(), count,
+                       r_bit, g_bit, b_bit, keep_mask,
+                       first_plane, end_plane,
+                       actual.data(), plane_stride);
+    if (memcmp(expected.data(), actual.data(),
+               expected.size() * sizeof(gpio_bits_t)) != 0) {
+      fprintf(stderr, "%s transpose differs from scalar: count=%d stride=%d "
+              "planes=%d..%d\n", TransposeBitplanesImplementation(),
+              count, plane_stride, first_plane, end_plane - 1);
+      return 1;
+    }
+  }
+  printf("bitplane transpose (%s): %d random cases match scalar.\n",
+         TransposeBitplanesImplementation(), kCases);
+  return 0;
+}
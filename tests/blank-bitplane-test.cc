@@ -0,0 +1,99 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// All black bitplanes are not clocked in, but the row has to take as long as
+// with them, otherwise dark rows would make the others brighter. Also, rows
+// that turn black need to be recognized as such again.
+
+#include "framebuffer-internal.h"
+#include "gpio.h"
+#include "simulated-panel-internal.h"
+#include "test-framebuffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace rgb_matrix;
+using namespace rgb_matrix::internal;
+
+static const int kRows = 32;
+static const int kColumns = 64;
+
+// Every row shows a single gray level, so most rows have blank bitplanes.
+// Each pixel has to come out with its own level, not brighter; allowing
+// for the rounding of 8 bit levels to bitplanes.
+static int CheckRowLevels(Framebuffer *fb, GPIO *io, SimulatedPanel *panel,
+                          const char *what) {
+  panel->Reset();
+  fb->DumpToMatrix(io, 0);
+  int errors = 0;
+  for (int y = 0; y < kRows; ++y) {
+    const int level = (y < 8) ? (1 << y) : (y * 255 / (kRows - 1));
+    uint8_t r, g, b;
+    if (!panel->GetPixel(y, y, &r, &g, &b) || abs(r - level) > 2
+        || abs(g - level) > 2 || abs(b - level) > 2) {
+      fprintf(stderr, "%s: row %d: level %d shown as %d/%d/%d\n",
+              what, y, level, r, g, b);
+      ++errors;
+    }
+  }
+  return errors;
+}
+
+int main() {
+  RGBMatrix::Options options;
+  options.rows = kRows;
+  options.cols = kColumns;
+  SimulatedPanel panel(TestFramebuffer::Mapping(options), kColumns, kRows,
+                       1, 0);
+  GPIO io;
+  TestFramebuffer test_frame(options, &panel, &io);
+  Framebuffer &fb = *test_frame.get();
+  fb.set_luminance_correct(false);
+
+  for (int y = 0; y < kRows; ++y) {
+    const int level = (y < 8) ? (1 << y) : (y * 255 / (kRows - 1));
+    for (int x = 0; x < kColumns; ++x) fb.SetPixel(x, y, level, level, level);
+  }
+  fb.RecomputeLitPlanes();
+  int errors = CheckRowLevels(&fb, &io, &panel, "direct");
+  fb.CompileOutput();
+  errors += CheckRowLevels(&fb, &io, &panel, "compiled");
+
+  // Rows 0 and kRows/2 are shown together. Make them black pixel by pixel:
+  // after RecomputeLitPlanes(), their bitplanes are not clocked in anymore.
+  Framebuffer::OutputCounts before, after;
+  for (int x = 0; x < kColumns; ++x) {
+    fb.SetPixel(x, 0, 1, 1, 1);
+    fb.SetPixel(x, kRows / 2, 1, 1, 1);
+  }
+  fb.RecomputeLitPlanes();
+  fb.DumpToMatrix(&io, 0, &before);
+  for (int x = 0; x < kColumns; ++x) {
+    fb.SetPixel(x, 0, 0, 0, 0);
+    fb.SetPixel(x, kRows / 2, 0, 0, 0);
+  }
+  fb.RecomputeLitPlanes();
+  fb.DumpToMatrix(&io, 0, &after);
+  if (after.blank_bitplanes <= before.blank_bitplanes) {
+    fprintf(stderr, "Rows turned black, but still %d blank bitplanes\n",
+            after.blank_bitplanes);
+    ++errors;
+  }
+
+  if (errors) return 1;
+  printf("blank bitplanes: row levels and recomputed lit planes OK.\n");
+  return 0;
+}
@@ -0,0 +1,194 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Checks that replaying a compiled output program gives the same register
+// writes and pulses as the direct output of DumpToMatrix(), bit for bit.
+// Two framebuffers get the same content; only one of them is compiled.
+
+#include "framebuffer-internal.h"
+#include "gpio.h"
+#include "simulated-panel-internal.h"
+#include "test-framebuffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+
+using namespace rgb_matrix;
+using namespace rgb_matrix::internal;
+
+static const int kRows = 32;
+static const int kColumns = 64;
+
+// Keeps all pulses in addition to the register writes.
+class RecordingPanel : public SimulatedPanel {
+public:
+  RecordingPanel(const HardwareMapping &h)
+    : SimulatedPanel(h, kColumns, kRows, 1, 0) {
+    SetRecording(true);
+  }
+
+  virtual void Pulse(gpio_bits_t bits, long nanos) {
+    SimulatedPanel::Pulse(bits, nanos);
+    const Pulsed p = { bits, nanos };
+    pulsed_.push_back(p);
+  }
+
+  void Restart() { Reset(); pulsed_.clear(); }
+
+  struct Pulsed { gpio_bits_t bits; long nanos; };
+  const std::vector<Pulsed> &pulsed() const { return pulsed_; }
+
+private:
+  std::vector<Pulsed> pulsed_;
+};
+
+struct Recording {
+  std::vector<SimulatedPanel::Write> writes;
+  std::vector<RecordingPanel::Pulsed> pulses;
+  Framebuffer::OutputCounts counts;
+};
+
+static Recording Record(RecordingPanel *panel, GPIO *io, Framebuffer *fb,
+                        int low_bit) {
+  Recording result;
+  fb->RecomputeLitPlanes();
+  fb->DumpToMatrix(io, low_bit);  // Same row address before each recording.
+  panel->Restart();
+  result.counts = Framebuffer::OutputCounts();
+  fb->DumpToMatrix(io, low_bit, &result.counts);
+  result.writes = panel->writes();
+  result.pulses = panel->pulsed();
+  return result;
+}
+
+static int Compare(const char *what, const Recording &expected,
+                   const Recording &actual) {
+  int errors = 0;
+  if (actual.writes.size() != expected.writes.size()) {
+    fprintf(stderr, "%s: %d register writes, expected %d.\n", what,
+            (int)actual.writes.size(), (int)expected.writes.size());
+    ++errors;
+  } else {
+    for (size_t i = 0; i < actual.writes.size(); ++i) {
+      if (actual.writes[i].set != expected.writes[i].set
+          || actual.writes[i].bits != expected.writes[i].bits) {
+        fprintf(stderr, "%s: register write %d differs.\n", what, (int)i);
+        ++errors;
+        break;
+      }
+    }
+  }
+  if (actual.pulses.size() != expected.pulses.size()) {
+    fprintf(stderr, "%s: %d pulses, expected %d.\n", what,
+            (int)actual.pulses.size(), (int)expected.pulses.size());
+    ++errors;
+  } else {
+    for (size_t i = 0; i < actual.pulses.size(); ++i) {
+      if (actual.pulses[i].bits != expected.pulses[i].bits
+          || actual.pulses[i].nanos != expected.pulses[i].nanos) {
+        fprintf(stderr, "%s: pulse %d differs.\n", what, (int)i);
+        ++errors;
+        break;
+      }
+    }
+  }
+  if (actual.counts.bitplanes != expected.counts.bitplanes
+      || actual.counts.blank_bitplanes != expected.counts.blank_bitplanes) {
+    fprintf(stderr, "%s: %d/%d bitplanes/blank, expected %d/%d.\n", what,
+            actual.counts.bitplanes, actual.counts.blank_bitplanes,
+            expected.counts.bitplanes, expected.counts.blank_bitplanes);
+    ++errors;
+  }
+  return errors;
+}
+
+// Random colors, with some black rows and dark pixels so that there are
+// blank bitplanes and shift register contents that can be kept.
+static void FillRandom(Framebuffer *a, Framebuffer *b) {
+  for (int y = 0; y < kRows; ++y) {
+    const int kind = rand() % 4;
+    for (int x = 0; x < kColumns; ++x) {
+      uint8_t r = 0, g = 0, bl = 0;
+      if (kind == 1) {
+        r = rand() % 16; g = rand() % 16; bl = rand() % 16;
+      } else if (kind > 1) {
+        r = rand(); g = rand(); bl = rand();
+      }
+      a->SetPixel(x, y, r, g, bl);
+      b->SetPixel(x, y, r, g, bl);
+    }
+  }
+}
+
+int main() {
+  RGBMatrix::Options options;
+  options.rows = kRows;
+  options.cols = kColumns;
+  RecordingPanel panel(TestFramebuffer::Mapping(options));
+  GPIO io;
+  TestFramebuffer compiled_frame(options, &panel, &io);
+  TestFramebuffer direct_frame(options, &panel, &io);
+  Framebuffer &compiled = *compiled_frame.get();
+  Framebuffer &direct = *direct_frame.get();
+
+  int errors = 0;
+  int cases = 0;
+  char what[64];
+  for (int split = 0; split <= 1; ++split) {
+    Framebuffer::SetSplitBitplanes(split);
+    for (int compact = 0; compact <= 1; ++compact) {
+      compiled.SetCompactStorage(compact);
+      direct.SetCompactStorage(compact);
+      for (int pwm_bits = 11; pwm_bits >= 7; pwm_bits -= 4) {
+        compiled.SetPWMBits(pwm_bits);
+        direct.SetPWMBits(pwm_bits);
+        for (int round = 0; round < 4; ++round) {
+          FillRandom(&compiled, &direct);
+          compiled.CompileOutput();
+          // low_bit > 0: the dither passes of a single pass refresh.
+          for (int low_bit = 0; low_bit <= 2; low_bit += 2) {
+            snprintf(what, sizeof(what), "split=%d compact=%d pwm=%d low=%d",
+                     split, compact, pwm_bits, low_bit);
+            errors += Compare(what, Record(&panel, &io, &direct, low_bit),
+                              Record(&panel, &io, &compiled, low_bit));
+            ++cases;
+          }
+
+          // A change after compiling makes the program stale.
+          compiled.SetPixel(round, round, 255, 0, 255);
+          direct.SetPixel(round, round, 255, 0, 255);
+          snprintf(what, sizeof(what), "changed split=%d compact=%d pwm=%d",
+                   split, compact, pwm_bits);
+          errors += Compare(what, Record(&panel, &io, &direct, 0),
+                            Record(&panel, &io, &compiled, 0));
+          ++cases;
+        }
+      }
+    }
+  }
+
+  // Recycle() drops the program with the rest of the content.
+  compiled.CompileOutput();
+  compiled.Recycle();
+  direct.Recycle();
+  errors += Compare("recycled", Record(&panel, &io, &direct, 0),
+                    Record(&panel, &io, &compiled, 0));
+  ++cases;
+
+  printf("%d compiled output comparisons, %d errors.\n", cases, errors);
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Round trip through the SimulatedPanel: pixels set on the canvas have to
+// show up where the pixel mappers put them, each LED on for exactly the
+// time of the bitplanes of its color. Covers scan modes, parallel chains, all
+// multiplexers, some pixel mappers and the row address types the simulator
+// decodes. With the others, all pulses have to be counted as unaddressed.
+//
+// The GPIO set-up of the Framebuffer is once per process, so each
+// configuration runs in a process of its own.
+
+#include "framebuffer-internal.h"
+#include "gpio.h"
+#include "multiplex-mappers-internal.h"
+#include "simulated-panel-internal.h"
+#include "test-framebuffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <vector>
+
+using namespace rgb_matrix;
+using namespace rgb_matrix::internal;
+
+static const int kLsbNanos = 130;
+
+struct Config {
+  const char *name;
+  int rows, cols, chain, parallel;
+  int scan_mode;
+  int multiplexing;
+  int row_address_type;
+  const char *pixel_mapper;  // Name, optionally with ":parameter".
+};
+
+// Colors that differ in all three channels between neighbors.
+static uint8_t Channel(int x, int y, int c) {
+  return (x * 7 + y * 31 + c * 85) * 13 % 256;
+}
+
+static const PixelMapper *FindNamedMapper(const Config &c) {
+  if (c.pixel_mapper == NULL) return NULL;
+  char name[64];
+  snprintf(name, sizeof(name), "%s", c.pixel_mapper);
+  char *param = strchr(name, ':');
+  if (param) *param++ = '\0';
+  return FindPixelMapper(name, c.chain, c.parallel, param);
+}
+
+static int Run(const Config &c) {
+  RGBMatrix::Options options;
+  options.rows = c.rows;
+  options.cols = c.cols;
+  options.chain_length = c.chain;
+  options.parallel = c.parallel;
+  options.scan_mode = c.scan_mode;
+  options.multiplexing = c.multiplexing;
+  options.row_address_type = c.row_address_type;
+  options.pwm_lsb_nanoseconds = kLsbNanos;
+  int columns, rows;
+  TestFramebuffer::PanelSize(options, &columns, &rows);
+  SimulatedPanel panel(TestFramebuffer::Mapping(options), columns, rows,
+                       c.parallel, c.row_address_type);
+  GPIO io;
+  TestFramebuffer fb(options, &panel, &io);
+  fb->set_luminance_correct(false);
+
+  // The mappers from the panels as wired to the canvas, and the size each
+  // one is applied to.
+  std::vector<const PixelMapper*> mappers;
+  std::vector<int> widths(1, columns), heights(1, rows * c.parallel);
+  if (c.multiplexing > 0) {
+    mappers.push_back(GetRegisteredMultiplexMappers()[c.multiplexing - 1]);
+  }
+  const PixelMapper *const named = FindNamedMapper(c);
+  if (c.pixel_mapper && (named == NULL || !fb.ApplyPixelMapper(named))) {
+    fprintf(stderr, "%s: can't apply %s\n", c.name, c.pixel_mapper);
+    return 1;
+  }
+  if (named) mappers.push_back(named);
+  for (size_t i = 0; i < mappers.size(); ++i) {
+    int w, h;
+    mappers[i]->GetSizeMapping(widths[i], heights[i], &w, &h);
+    widths.push_back(w);
+    heights.push_back(h);
+  }
+  const int width = fb->width(), height = fb->height();
+  if (width != widths.back() || height != heights.back()) {
+    fprintf(stderr, "%s: canvas %dx%d, mappers give %dx%d\n", c.name,
+            width, height, widths.back(), heights.back());
+    return 1;
+  }
+
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      fb->SetPixel(x, y, Channel(x, y, 0), Channel(x, y, 1), Channel(x, y, 2));
+    }
+  }
+  fb->RecomputeLitPlanes();
+  fb->DumpToMatrix(&io, 0);  // Settle the row address.
+  panel.Reset();
+  fb->DumpToMatrix(&io, 0);
+
+  if (c.row_address_type == 1 || c.row_address_type == 3
+      || c.row_address_type == 5) {
+    // Shift register row addresses are not decoded by the simulator.
+    if (panel.pulses() == 0 || panel.unaddressed_pulses() != panel.pulses()) {
+      fprintf(stderr, "%s: %ld of %ld pulses unaddressed, expected all\n",
+              c.name, panel.unaddressed_pulses(), panel.pulses());
+      return 1;
+    }
+    printf("%-28s: row address type %d not decoded, %ld pulses unaddressed\n",
+           c.name, c.row_address_type, panel.unaddressed_pulses());
+    return 0;
+  }
+
+  int errors = 0;
+  if (panel.unaddressed_pulses() != 0) {
+    fprintf(stderr, "%s: %ld pulses without a decoded row address\n",
+            c.name, panel.unaddressed_pulses());
+    ++errors;
+  }
+  std::vector<int> shown(columns * rows * c.parallel, 0);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      int px = x, py = y;
+      for (int i = mappers.size() - 1; i >= 0; --i) {
+        mappers[i]->MapVisibleToMatrix(widths[i], heights[i], px, py,
+                                       &px, &py);
+      }
+      uint8_t rgb[3];
+      if (!panel.GetPixel(px, py, &rgb[0], &rgb[1], &rgb[2])) {
+        fprintf(stderr, "%s: (%d,%d) -> (%d,%d) not shown\n",
+                c.name, x, y, px, py);
+        ++errors;
+        continue;
+      }
+      ++shown[py * columns + px];
+      for (int ch = 0; ch < 3; ++ch) {
+        // Without luminance correction, the color is the upper 8 of the
+        // bitplanes, each twice as long as the one below.
+        const int level = Channel(x, y, ch) << (Framebuffer::kBitPlanes - 8);
+        const int64_t expected_ns = (int64_t)level * kLsbNanos;
+        const int64_t ns = panel.OnTime(px, py, ch);
+        // The simulator scales to 255 for all bitplanes, one level more.
+        if (ns != expected_ns || abs(rgb[ch] - Channel(x, y, ch)) > 1) {
+          fprintf(stderr, "%s: (%d,%d) -> (%d,%d) color %d: %d on %lldns, "
+                  "expected %d on %lldns\n", c.name, x, y, px, py, ch,
+                  rgb[ch], (long long)ns, Channel(x, y, ch),
+                  (long long)expected_ns);
+          ++errors;
+        }
+      }
+      if (errors > 10) return 1;
+    }
+  }
+  // Each LED is used by at most one pixel; the others stay dark.
+  int unused = 0;
+  for (int py = 0; py < rows * c.parallel; ++py) {
+    for (int px = 0; px < columns; ++px) {
+      const int n = shown[py * columns + px];
+      uint8_t r = 0, g = 0, b = 0;
+      if (n > 1) {
+        fprintf(stderr, "%s: LED (%d,%d) used by %d pixels\n",
+                c.name, px, py, n);
+        ++errors;
+      } else if (n == 0) {
+        ++unused;
+        if (panel.GetPixel(px, py, &r, &g, &b) && (r || g || b)) {
+          fprintf(stderr, "%s: unused LED (%d,%d) is lit\n", c.name, px, py);
+          ++errors;
+        }
+      }
+    }
+  }
+  printf("%-28s: %3dx%-3d canvas on %3dx%-3d LEDs (%d unused) OK\n", c.name,
+         width, height, columns, rows * c.parallel, unused);
+  return errors ? 1 : 0;
+}
+
+int main() {
+  std::vector<Config> configs;
+  const Config fixed[] = {
+    { "progressive",       32, 64, 1, 1, 0, 0, 0, NULL },
+    { "interlaced",        32, 64, 1, 1, 1, 0, 0, NULL },
+    { "64 rows",           64, 64, 1, 1, 0, 0, 0, NULL },
+    { "chain 2, parallel 3", 32, 32, 2, 3, 0, 0, 0, NULL },
+    { "ABCD lines",         8, 32, 1, 1, 0, 0, 2, NULL },
+    { "SM5266",            32, 64, 1, 1, 0, 0, 4, NULL },
+    { "SM5266 interlaced", 32, 64, 1, 1, 1, 0, 4, NULL },
+    { "Rotate:90",         32, 64, 1, 1, 0, 0, 0, "Rotate:90" },
+    { "Mirror:V",          32, 64, 1, 1, 0, 0, 0, "Mirror:V" },
+    { "U-mapper",          32, 32, 4, 2, 0, 0, 0, "U-mapper" },
+    { "V-mapper:Z",        32, 32, 2, 2, 0, 0, 0, "V-mapper:Z" },
+    { "stripe, Rotate:180", 16, 32, 2, 1, 0, 1, 0, "Rotate:180" },
+    { "shift register",    32, 64, 1, 1, 0, 0, 1, NULL },
+    { "ABC shift register", 32, 64, 1, 1, 0, 0, 3, NULL },
+    { "B707 shift register", 32, 64, 1, 1, 0, 0, 5, NULL },
+  };
+  configs.assign(fixed, fixed + sizeof(fixed) / sizeof(fixed[0]));
+  // Each multiplexer on 32x16 panels, unless it is made for another size.
+  const struct { const char *name; int rows, cols; } kPanelSizes[] = {
+    { "coreman", 32, 32 },
+    { "QiangLiQ8", 20, 40 },
+    { "P8Outdoor1R1G1", 20, 40 },
+    { "P3Outdoor64x64MultiplexMapper", 64, 64 },
+  };
+  const MuxMapperList &multiplexers = GetRegisteredMultiplexMappers();
+  for (size_t i = 0; i < multiplexers.size(); ++i) {
+    Config multiplexed = { multiplexers[i]->GetName(), 16, 32, 1, 1, 0,
+                           (int)i + 1, 0, NULL };
+    for (size_t p = 0; p < sizeof(kPanelSizes) / sizeof(kPanelSizes[0]); ++p) {
+      if (strcmp(kPanelSizes[p].name, multiplexed.name) == 0) {
+        multiplexed.rows = kPanelSizes[p].rows;
+        multiplexed.cols = kPanelSizes[p].cols;
+      }
+    }
+    configs.push_back(multiplexed);
+  }
+
+  int failed = 0;
+  for (size_t i = 0; i < configs.size(); ++i) {
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0) exit(Run(configs[i]));
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "%s: FAILED\n", configs[i].name);
+      ++failed;
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Drives the SlowdownTuner with a simulated GPIO, in which each register
+// write takes a fixed time on a simulated clock, and checks the measured
+// rows and what is picked from them. Tune() itself is not run: it uses the
+// cache file of the system.
+
+#include "framebuffer-internal.h"
+#include "gpio.h"
+#include "slowdown-tuner-internal.h"
+
+#include <stdio.h>
+
+#include <vector>
+
+using namespace rgb_matrix;
+using namespace rgb_matrix::internal;
+
+static const int kColumns = 64;
+static const long kWriteNanos = 20;
+
+static uint64_t simulated_now_ns = 0;
+
+// Each register write advances the simulated clock. A stall can be added
+// to the next write, as if the tuner was interrupted.
+class ClockedBackend : public GPIOBackend {
+public:
+  ClockedBackend() : writes_(0), stall_ns_(0) {}
+
+  virtual void WriteSetBits(gpio_bits_t value) { Advance(); }
+  virtual void WriteClrBits(gpio_bits_t value) { Advance(); }
+  virtual void Pulse(gpio_bits_t bits, long nanos) {
+    simulated_now_ns += nanos;
+  }
+
+  void StallNextWrite(long nanos) { stall_ns_ = nanos; }
+  long writes() const { return writes_; }
+
+private:
+  void Advance() {
+    ++writes_;
+    simulated_now_ns += kWriteNanos + stall_ns_;
+    stall_ns_ = 0;
+  }
+
+  long writes_;
+  long stall_ns_;
+};
+
+class SimulatedTimeTuner : public SlowdownTuner {
+public:
+  SimulatedTimeTuner(GPIO *io)
+    : SlowdownTuner(io, Framebuffer::hardware_mapping(), kColumns) {}
+
+protected:
+  virtual uint64_t NowNanos() { return simulated_now_ns; }
+};
+
+static SlowdownTuner::Measurement Make(int slowdown, int clock_khz) {
+  SlowdownTuner::Measurement m;
+  m.slowdown = slowdown;
+  m.row_nanos = clock_khz > 0 ? (long)kColumns * 1000000 / clock_khz : -1;
+  m.clock_khz = clock_khz;
+  return m;
+}
+
+int main() {
+  Framebuffer::InitHardwareMapping("regular");
+  ClockedBackend backend;
+  GPIO io;
+  io.Init(&backend);
+  SimulatedTimeTuner tuner(&io);
+  int errors = 0;
+
+  // A row takes the time of the register writes it needs; every slowdown
+  // step adds writes.
+  const long before = backend.writes();
+  const SlowdownTuner::Measurement single = tuner.Measure(0, 1);
+  const long row_writes = backend.writes() - before;
+  if (single.row_nanos != row_writes * kWriteNanos) {
+    fprintf(stderr, "Row of %ld writes measured %ldns, expected %ldns.\n",
+            row_writes, single.row_nanos, row_writes * kWriteNanos);
+    ++errors;
+  }
+
+  // The best of the runs is taken: a stall in one of them doesn't count.
+  backend.StallNextWrite(100000);
+  const SlowdownTuner::Measurement stalled = tuner.Measure(0, 3);
+  if (stalled.row_nanos != single.row_nanos) {
+    fprintf(stderr, "Stalled run counted: %ldns, expected %ldns.\n",
+            stalled.row_nanos, single.row_nanos);
+    ++errors;
+  }
+
+  io.SetSlowdown(2);
+  const std::vector<SlowdownTuner::Measurement> sweep = tuner.Sweep(0, 5, 2);
+  if (io.slowdown() != 2) {
+    fprintf(stderr, "Sweep left slowdown at %d.\n", io.slowdown());
+    ++errors;
+  }
+  if (sweep.size() != 6) {
+    fprintf(stderr, "Sweep of 6 slowdowns has %d measurements.\n",
+            (int)sweep.size());
+    return 1;
+  }
+  for (size_t i = 0; i < sweep.size(); ++i) {
+    const SlowdownTuner::Measurement &m = sweep[i];
+    printf("slowdown %d: %5ldns per row, %5d kHz\n",
+           m.slowdown, m.row_nanos, m.clock_khz);
+    if (m.slowdown != (int)i
+        || m.clock_khz != (int)((int64_t)kColumns * 1000000 / m.row_nanos)
+        || (i > 0 && m.row_nanos <= sweep[i-1].row_nanos)) {
+      fprintf(stderr, "Unexpected measurement for slowdown %d.\n", (int)i);
+      ++errors;
+    }
+  }
+
+  // Picked: the fastest clock the panel can follow; the slowest if none.
+  SlowdownTuner::Measurement picked;
+  if (!SlowdownTuner::Pick(sweep, sweep[2].clock_khz, &picked)
+      || picked.slowdown != 2) {
+    fprintf(stderr, "Picked slowdown %d, expected 2.\n", picked.slowdown);
+    ++errors;
+  }
+  if (!SlowdownTuner::Pick(sweep, sweep[3].clock_khz + 1, &picked)
+      || picked.slowdown != 3) {
+    fprintf(stderr, "Picked slowdown %d, expected 3.\n", picked.slowdown);
+    ++errors;
+  }
+  if (SlowdownTuner::Pick(sweep, sweep[5].clock_khz - 1, &picked)
+      || picked.slowdown != 5) {
+    fprintf(stderr, "Too fast clock not reported with the slowest.\n");
+    ++errors;
+  }
+
+  // The barrier delay (-1) can be slower than 0; rows not measured are
+  // never picked.
+  std::vector<SlowdownTuner::Measurement> unordered;
+  unordered.push_back(Make(-1, 9000));
+  unordered.push_back(Make(0, 16000));
+  unordered.push_back(Make(1, 8000));
+  unordered.push_back(Make(2, 0));
+  if (!SlowdownTuner::Pick(unordered, 10000, &picked)
+      || picked.slowdown != -1) {
+    fprintf(stderr, "Picked slowdown %d, expected -1.\n", picked.slowdown);
+    ++errors;
+  }
+  if (SlowdownTuner::Pick(unordered, 1000, &picked) || picked.slowdown != 1) {
+    fprintf(stderr, "Picked slowdown %d as slowest, expected 1.\n",
+            picked.slowdown);
+    ++errors;
+  }
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Measures how the on-time of a LED is spread over a refresh, with and
+// without split bitplanes. Time is the sum of the pulses of the refresh,
+// dark ones included; clocking in is not simulated. With split bitplanes,
+// the long pulses of the high bitplanes have to be spread over the
+// kSplitPasses passes instead of being shown in one go.
+
+#include "framebuffer-internal.h"
+#include "gpio.h"
+#include "simulated-panel-internal.h"
+#include "test-framebuffer.h"
+
+#include <stdio.h>
+
+#include <vector>
+
+using namespace rgb_matrix;
+using namespace rgb_matrix::internal;
+
+static const int kRows = 32;
+static const int kColumns = 64;
+static const int kSlots = 8;  // Parts of the refresh the on-time is put in.
+
+// Keeps when the observed LED was on, in time of all pulses so far.
+class TimelinePanel : public SimulatedPanel {
+public:
+  TimelinePanel(const HardwareMapping &h, int x, int y)
+    : SimulatedPanel(h, kColumns, kRows, 1, 0),
+      x_(x), y_(y), now_ns_(0) {}
+
+  virtual void Pulse(gpio_bits_t bits, long nanos) {
+    const int64_t before = OnTime(x_, y_, 0);
+    SimulatedPanel::Pulse(bits, nanos);
+    if (OnTime(x_, y_, 0) != before) {
+      const Interval on = { now_ns_, nanos };
+      on_.push_back(on);
+    }
+    now_ns_ += nanos;
+  }
+
+  void Restart() { Reset(); on_.clear(); now_ns_ = 0; }
+
+  struct Interval { int64_t start_ns; long nanos; };
+  const std::vector<Interval> &on() const { return on_; }
+  int64_t now_ns() const { return now_ns_; }
+
+private:
+  const int x_, y_;
+  int64_t now_ns_;
+  std::vector<Interval> on_;
+};
+
+struct Spread {
+  int pulses;
+  long longest_ns;
+  double slot_share[kSlots];  // Fraction of the on-time in each slot.
+};
+
+static Spread Measure(TimelinePanel *panel, Framebuffer *fb, GPIO *io) {
+  fb->DumpToMatrix(io, 0);  // Settle the row address.
+  panel->Restart();
+  fb->DumpToMatrix(io, 0);
+  Spread result = { 0, 0, {} };
+  const double refresh_ns = panel->now_ns();
+  double total = 0;
+  for (size_t i = 0; i < panel->on().size(); ++i) {
+    const TimelinePanel::Interval &on = panel->on()[i];
+    ++result.pulses;
+    if (on.nanos > result.longest_ns) result.longest_ns = on.nanos;
+    // Attributed to the slot the pulse starts in; pulses are short
+    // compared to a slot, except for the unsplit high bitplanes.
+    const int slot = on.start_ns * kSlots / refresh_ns;
+    result.slot_share[slot] += on.nanos;
+    total += on.nanos;
+  }
+  for (int s = 0; s < kSlots; ++s) result.slot_share[s] /= total;
+  return result;
+}
+
+static void Print(const char *what, const Spread &s) {
+  printf("%-9s: %3d pulses, longest %6.1fus, on-time per 1/%d refresh:",
+         what, s.pulses, s.longest_ns / 1000.0, kSlots);
+  for (int i = 0; i < kSlots; ++i) printf(" %3.0f%%", 100 * s.slot_share[i]);
+  printf("\n");
+}
+
+int main() {
+  RGBMatrix::Options options;
+  options.rows = kRows;
+  options.cols = kColumns;
+  // A white LED in the middle of the panel.
+  TimelinePanel panel(TestFramebuffer::Mapping(options),
+                      kColumns / 2, kRows / 4);
+  GPIO io;
+  TestFramebuffer fb(options, &panel, &io);
+  fb->Fill(255, 255, 255);
+
+  Framebuffer::SetSplitBitplanes(false);
+  const Spread single = Measure(&panel, fb.get(), &io);
+  Framebuffer::SetSplitBitplanes(true);
+  const Spread split = Measure(&panel, fb.get(), &io);
+  Print("unsplit", single);
+  Print("split", split);
+
+  // Each split bitplane is shown kSplitPasses times with the pulse of
+  // kSplitPlane, evenly in every part of the refresh.
+  int errors = 0;
+  if (split.longest_ns * 8 > single.longest_ns) {
+    fprintf(stderr, "Longest pulse not split in 8.\n");
+    ++errors;
+  }
+  for (int i = 0; i < kSlots; ++i) {
+    if (split.slot_share[i] < 0.5 / kSlots
+        || split.slot_share[i] > 2.0 / kSlots) {
+      fprintf(stderr, "Uneven split: %.0f%% of the on-time in slot %d.\n",
+              100 * split.slot_share[i], i);
+      ++errors;
+    }
+  }
+  return errors ? 1 : 0;
+}
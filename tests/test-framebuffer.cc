@@ -0,0 +1,86 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+#include "test-framebuffer.h"
+
+#include "multiplex-mappers-internal.h"
+
+namespace rgb_matrix {
+using internal::Framebuffer;
+
+static const internal::MultiplexMapper *
+GetMultiplexMapper(const RGBMatrix::Options &options) {
+  const internal::MuxMapperList &multiplexers =
+    internal::GetRegisteredMultiplexMappers();
+  if (options.multiplexing <= 0
+      || options.multiplexing > (int)multiplexers.size()) {
+    return NULL;
+  }
+  return multiplexers[options.multiplexing - 1];
+}
+
+/* static */ const HardwareMapping &TestFramebuffer::Mapping(
+  const RGBMatrix::Options &options) {
+  Framebuffer::InitHardwareMapping(options.hardware_mapping);
+  return Framebuffer::hardware_mapping();
+}
+
+/* static */ void TestFramebuffer::PanelSize(const RGBMatrix::Options &options,
+                                             int *columns, int *rows) {
+  *columns = options.cols;
+  *rows = options.rows;
+  const internal::MultiplexMapper *multiplexer = GetMultiplexMapper(options);
+  if (multiplexer) multiplexer->EditColsRows(columns, rows);
+  *columns *= options.chain_length;
+}
+
+// Same steps as the RGBMatrix::Impl constructor, SetGPIO() and
+// CreateFrameCanvas().
+TestFramebuffer::TestFramebuffer(const RGBMatrix::Options &options,
+                                 GPIOBackend *backend, GPIO *io)
+  : mapper_(NULL) {
+  int columns, rows;
+  PanelSize(options, &columns, &rows);
+  Framebuffer::InitHardwareMapping(options.hardware_mapping);
+  io->Init(backend);
+  Framebuffer::InitGPIO(io, rows, options.parallel,
+                        !options.disable_hardware_pulsing,
+                        options.pwm_lsb_nanoseconds, options.pwm_dither_bits,
+                        options.row_address_type);
+  Framebuffer::SetSplitBitplanes(options.split_bitplanes);
+  frame_ = new Framebuffer(rows, columns, options.parallel, options.scan_mode,
+                           options.led_rgb_sequence, options.inverse_colors,
+                           &mapper_);
+  frame_->SetPWMBits(options.pwm_bits);
+  frame_->SetBrightness(options.brightness);
+  frame_->Clear();
+  ApplyPixelMapper(GetMultiplexMapper(options));
+}
+
+TestFramebuffer::~TestFramebuffer() {
+  delete frame_;
+  delete mapper_;
+}
+
+bool TestFramebuffer::ApplyPixelMapper(const PixelMapper *mapper) {
+  if (mapper == NULL) return true;
+  internal::PixelDesignatorMap *const mapped =
+    internal::ApplyPixelMapper(*mapper, mapper_);
+  if (mapped == NULL) return false;
+  delete mapper_;
+  mapper_ = mapped;
+  return true;
+}
+}  // namespace rgb_matrix
@@ -0,0 +1,61 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2013 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Set-up shared by the tests: a Framebuffer as the RGBMatrix creates it,
+// without the refresh thread, that outputs to a GPIOBackend such as the
+// SimulatedPanel.
+
+#ifndef RPI_RGBMATRIX_TEST_FRAMEBUFFER_H
+#define RPI_RGBMATRIX_TEST_FRAMEBUFFER_H
+
+#include "framebuffer-internal.h"
+#include "gpio.h"
+#include "hardware-mapping.h"
+#include "led-matrix.h"
+#include "pixel-mapper.h"
+
+namespace rgb_matrix {
+class TestFramebuffer {
+public:
+  // Hardware mapping of "options", which a backend needs to be created
+  // before the TestFramebuffer.
+  static const HardwareMapping &Mapping(const RGBMatrix::Options &options);
+
+  // Columns and rows of the panels as they are wired, which multiplexing
+  // changes; what a SimulatedPanel for "options" is created with.
+  static void PanelSize(const RGBMatrix::Options &options,
+                        int *columns, int *rows);
+
+  // Initializes "io" to output to "backend" and creates the Framebuffer
+  // for "options", with its multiplexing applied. The pixel_mapper_config
+  // is not parsed, see ApplyPixelMapper(). The GPIO set-up of the
+  // Framebuffer is only done once per process, so all TestFramebuffers of
+  // a test share "io" and the options.
+  TestFramebuffer(const RGBMatrix::Options &options, GPIOBackend *backend,
+                  GPIO *io);
+  ~TestFramebuffer();
+
+  // As RGBMatrix::ApplyPixelMapper(); before any pixels are set.
+  bool ApplyPixelMapper(const PixelMapper *mapper);
+
+  internal::Framebuffer *operator->() const { return frame_; }
+  internal::Framebuffer *get() const { return frame_; }
+
+private:
+  internal::PixelDesignatorMap *mapper_;  // Owned; the RGBMatrix shares it.
+  internal::Framebuffer *frame_;
+};
+}  // namespace rgb_matrix
+#endif  // RPI_RGBMATRIX_TEST_FRAMEBUFFER_H
@@ -0,0 +1,138 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2015 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Measures how long FrameCanvas::Commit() takes to convert a fully changed
+// RGB back buffer with 0..N conversion threads. Doesn't need any hardware:
+// no GPIO is initialized and nothing is displayed.
+
+#include "led-matrix.h"
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+using namespace rgb_matrix;
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Measures Commit() with 0..N conversion threads.\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr,
+          "\t-n <commits>      : Commits per measurement (Default: 100)\n"
+          "\t-t <threads>      : Highest number of conversion threads "
+          "(Default: %d)\n", RGBMatrix::kMaxConversionThreads);
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+static uint64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Best of a few runs, in microseconds per Commit(). Every commit converts
+// the whole canvas, as all pixels are written before it.
+static double MeasureCommit(FrameCanvas *canvas, std::vector<Color> &image,
+                            int commits) {
+  const int kRuns = 5;
+  double best = -1;
+  for (int run = 0; run < kRuns; ++run) {
+    uint64_t total = 0;
+    for (int i = 0; i < commits; ++i) {
+      canvas->SetPixels(0, 0, canvas->width(), canvas->height(), image.data());
+      const uint64_t start = NowNanos();
+      canvas->Commit();
+      total += NowNanos() - start;
+    }
+    const double us = total / 1000.0 / commits;
+    if (best < 0 || us < best) best = us;
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  // 192x192 unless chosen otherwise.
+  matrix_options.rows = 64;
+  matrix_options.cols = 64;
+  matrix_options.chain_length = 3;
+  matrix_options.parallel = 3;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+  runtime_opt.do_gpio_init = false;  // Only measuring the canvas.
+  runtime_opt.daemon = -1;
+
+  int commits = 100;
+  int max_threads = RGBMatrix::kMaxConversionThreads;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+    switch (opt) {
+    case 'n': commits = atoi(optarg); break;
+    case 't': max_threads = atoi(optarg); break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (commits < 1 || max_threads < 0
+      || max_threads > RGBMatrix::kMaxConversionThreads) {
+    return usage(argv[0]);
+  }
+
+  std::string reference;  // Converted output with 0 threads.
+  for (int threads = 0; threads <= max_threads; ++threads) {
+    matrix_options.conversion_threads = threads;
+    RGBMatrix *matrix = RGBMatrix::CreateFromOptions(matrix_options,
+                                                     runtime_opt);
+    if (matrix == NULL)
+      return 1;
+    FrameCanvas *canvas = matrix->CreateFrameCanvas();
+    canvas->SetRGBBackBuffer(true);
+
+    std::vector<Color> image(canvas->width() * canvas->height());
+    srandom(42);
+    for (size_t i = 0; i < image.size(); ++i) {
+      image[i] = Color(random() & 0xff, random() & 0xff, random() & 0xff);
+    }
+
+    if (threads == 0) {
+      printf("%dx%d canvas, random colors, us/Commit()\n",
+             canvas->width(), canvas->height());
+    }
+    const double us = MeasureCommit(canvas, image, commits);
+
+    const char *data;
+    size_t len;
+    canvas->Serialize(&data, &len);
+    if (threads == 0) reference.assign(data, len);
+    const bool same = (len == reference.size()
+                       && memcmp(data, reference.data(), len) == 0);
+    printf("%d conversion threads: %8.1f%s\n", threads, us,
+           same ? "" : "  (output differs from 0 threads!)");
+    delete matrix;
+    if (!same) return 1;
+  }
+  return 0;
+}
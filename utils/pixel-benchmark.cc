@@ -0,0 +1,143 @@
+// -*- mode: c++; c-basic-offset: 2; indent-tabs-mode: nil; -*-
+// Copyright (C) 2015 Henner Zeller <h.zeller@acm.org>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation version 2.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://gnu.org/licenses/gpl-2.0.txt>
+
+// Measures how long it takes to get pixels into a FrameCanvas. Doesn't
+// need any hardware: no GPIO is initialized and nothing is displayed.
+
+#include "led-matrix.h"
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <vector>
+
+using namespace rgb_matrix;
+
+static int usage(const char *progname) {
+  fprintf(stderr, "usage: %s [options]\n", progname);
+  fprintf(stderr, "Measures nanoseconds per pixel of writing a canvas.\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr,
+          "\t-n <frames>       : Frames to write per measurement "
+          "(Default: 200)\n");
+  fprintf(stderr, "\nGeneral LED matrix options:\n");
+  rgb_matrix::PrintMatrixFlags(stderr);
+  return 1;
+}
+
+static uint64_t NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void WriteSetPixel(FrameCanvas *canvas, std::vector<Color> &image) {
+  const int width = canvas->width();
+  const int height = canvas->height();
+  const Color *c = image.data();
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x, ++c) {
+      canvas->SetPixel(x, y, c->r, c->g, c->b);
+    }
+  }
+}
+
+static void WriteSetPixels(FrameCanvas *canvas, std::vector<Color> &image) {
+  canvas->SetPixels(0, 0, canvas->width(), canvas->height(), image.data());
+}
+
+// Best of a few runs, in nanoseconds per pixel.
+static double Measure(FrameCanvas *canvas, std::vector<Color> &image,
+                      void (*write)(FrameCanvas *, std::vector<Color> &),
+                      int frames) {
+  const int kRuns = 5;
+  double best = -1;
+  for (int run = 0; run < kRuns; ++run) {
+    const uint64_t start = NowNanos();
+    for (int i = 0; i < frames; ++i) {
+      write(canvas, image);
+    }
+    const double ns = (double)(NowNanos() - start) / frames / image.size();
+    if (best < 0 || ns < best) best = ns;
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  RGBMatrix::Options matrix_options;
+  rgb_matrix::RuntimeOptions runtime_opt;
+  // 192x192 unless chosen otherwise.
+  matrix_options.rows = 64;
+  matrix_options.cols = 64;
+  matrix_options.chain_length = 3;
+  matrix_options.parallel = 3;
+  if (!rgb_matrix::ParseOptionsFromFlags(&argc, &argv,
+                                         &matrix_options, &runtime_opt)) {
+    return usage(argv[0]);
+  }
+  runtime_opt.do_gpio_init = false;  // Only measuring the canvas.
+  runtime_opt.daemon = -1;
+
+  int frames = 200;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n': frames = atoi(optarg); break;
+    default:
+      return usage(argv[0]);
+    }
+  }
+  if (frames < 1) return usage(argv[0]);
+
+  RGBMatrix *matrix = RGBMatrix::CreateFromOptions(matrix_options,
+                                                   runtime_opt);
+  if (matrix == NULL)
+    return 1;
+  FrameCanvas *canvas = matrix->CreateFrameCanvas();
+
+  std::vector<Color> image(canvas->width() * canvas->height());
+  srandom(42);
+  for (size_t i = 0; i < image.size(); ++i) {
+    image[i] = Color(random() & 0xff, random() & 0xff, random() & 0xff);
+  }
+
+  // The color mapping depends on brightness and luminance correction, so
+  // measure with a few combinations of them.
+  static const struct {
+    int brightness;
+    bool luminance_correct;
+  } kSettings[] = {
+    { 100, true }, { 100, false }, { 50, true }, { 50, false },
+  };
+  printf("%dx%d canvas, random colors, ns/pixel\n",
+         canvas->width(), canvas->height());
+  printf("brightness luminance-correct  SetPixel()  SetPixels()\n");
+  for (size_t i = 0; i < sizeof(kSettings) / sizeof(kSettings[0]); ++i) {
+    matrix->SetBrightness(kSettings[i].brightness);
+    matrix->set_luminance_correct(kSettings[i].luminance_correct);
+    const double set_pixel = Measure(canvas, image, WriteSetPixel, frames);
+    const double set_pixels = Measure(canvas, image, WriteSetPixels, frames);
+    printf("%9d%% %17s  %10.2f  %11.2f\n",
+           kSettings[i].brightness,
+           kSettings[i].luminance_correct ? "yes" : "no",
+           set_pixel, set_pixels);
+  }
+
+  delete matrix;
+  return 0;
+}